@@ -5,22 +5,161 @@
 //
 // * Read displayed value:
 // cat /sys/class/display7/<display-name>/digit
+//  prints "<character> <segment mask> <commit sequence>", e.g. "7 0x07 12",
+//  all from the same commit. A blank shows as \x20, a raw mask as \x00.
+//
+// * Write a sequence of frames in a single syscall:
+//  write() an array of 'struct display7_frame' (see display7.h) to
+//  /dev/display7-<N>. Frames are applied in order, each one held for its
+//  own dwell time.
+//
+// * Update without syscalls:
+//  mmap() /dev/display7-<N> and write raw segment masks into the shared
+//  page (see display7.h). Changes are picked up every 'fb_refresh_ms'
+//  milliseconds while the page is mapped, or on DISPLAY7_IOC_DOORBELL.
+//
+// * Write a string:
+//  echo 12.5 > /sys/class/display7/<display-name>/digit
+//  shows the characters on this display and the ones after it, a '.'
+//  lighting the decimal point of the character before it. Strings longer
+//  than the remaining displays scroll in a loop, one step every
+//  'scroll_ms' milliseconds, until one of those displays is written again.
 //
 // <display-name> comes from device-tree 
 //
 //
 // Parses device tree to setup GPIOS to drive the display (see NOTE below).
 // Uses a custom user-space framework to drive the LED display to show
-// a character between 0 and F.
+// a character between 0 and F (either case), H, h, J, L, n, o, P, r, t,
+// U, u, y, '-', '_', '=', '*' (degree) and blank. Anything else shows '8'.
+//
+// * Update several displays at once:
+//  write() frames flagged DISPLAY7_FRAME_DEFER to each display, then
+//  issue DISPLAY7_IOC_COMMIT on any of them. All deferred masks go out in
+//  a single gpiod_set_array_value() call (one register write per chip).
+//
+// * Update several displays atomically:
+//  DISPLAY7_IOC_TXN takes (display index, segment mask) pairs, checks
+//  them all and outputs them together, e.g. "0999" to "1000" without any
+//  intermediate state on the panel (see display7.h).
+//
+// * Write a raw segment mask (bit order as in segment_table[]):
+//  echo 0x49 > /sys/class/display7/<display-name>/segments
+//  or DISPLAY7_IOC_SET_SEGMENTS on /dev/display7-<N>.
+//
+// * Custom glyphs:
+//  /sys/class/display7/<display-name>/glyphs is a 128 byte binary file
+//  holding the segment mask shown for each ASCII character. Writing it
+//  replaces the glyphs of the panel from the given offset on.
+//
+// * Counters (writes, '8' fallbacks, GPIO errors, skipped commits, FIFO
+//   underruns, refresh timer jitter), kept per CPU where writers update them:
+//  cat /sys/class/display7/<display-name>/stats
+//
+// * Slow (sleeping) GPIO controllers and SPI panels:
+//  When a segment line sits behind an I2C/SPI expander, on SPI panels
+//  (see below), or with the 'deferred-commit' property, writers only
+//  record the requested frame.
+//  A dedicated workqueue outputs the latest one, so a burst of writes
+//  costs a single bus transaction per changed line.
+//
+// * Multiplexed panels:
+//  With 'scan-mode = "multiplexed"' the displays share one set of segment
+//  lines and each one only has a digit-select line. An hrtimer lights the
+//  displays one after the other, 'refresh_hz' full cycles per second.
+//  With 'refresh_hz_min' below 'refresh_hz_max' (DT 'refresh-rate-min-hz'
+//  and 'refresh-rate-hz') the rate drops to the minimum once the content
+//  has been stable for a second and goes back up with the next change;
+//  'refresh_hz' shows the rate in use, writing it fixes both bounds.
+//  'scan_mode' tells which mode a panel runs in, the scan_* lines of
+//  'stats' how late the timer fired (jitter) and how many slots it missed.
+//  Writers fill a back frame that the timer swaps in at the start of a
+//  cycle, so it never waits for them; DISPLAY7_IOC_WAIT_VSYNC blocks
+//  until that swap, i.e. until earlier writes are on the panel.
+//
+// * Brightness:
+//  echo <0-15> > /sys/class/display7/<display-name>/brightness
+//  echo "15 15 15 15 15 15 15 4" > .../segment_brightness  (a..g, dp)
+//  Displays with a 'pwms' property dim through their PWM. Anything else
+//  is dimmed by binary code modulation: each refresh slot is split into
+//  4 planes of 1, 2, 4 and 8 time units, a segment being lit in the planes
+//  matching the bits of its level. Static panels only run the refresh
+//  timer while some segment is dimmed, and need non-sleeping GPIOS for it.
+//  Panels with 'commit-groups' can't use BAM.
+//
+// * Wait for changes:
+//  poll() 'digit' for POLLPRI (sysfs_notify) and re-read it, or poll()
+//  /dev/display7-<N> for POLLIN and read() 'struct display7_event's (see
+//  display7.h), one per commit of the display since the file was opened,
+//  with the process that requested it. Every display keeps the last
+//  HISTORY_LEN commits in a ring that all its readers stream from.
+//
+// * Hardware-timed animations:
+//  DISPLAY7_IOC_FIFO_PUSH queues (segment mask, duration) entries that an
+//  hrtimer plays back on the display, optionally in a loop, until
+//  DISPLAY7_IOC_FIFO_FLUSH. Other writes to the display last until the
+//  next entry.
+//  cat /sys/class/display7/<display-name>/fifo_depth      (queued, size)
+//
+// * Fast path on SoC GPIO banks:
+//  With the 'direct-gpio' property on a static, non-deferred panel, every
+//  display whose lines all sit on one memory-mapped bank is written
+//  straight through the bank's set_multiple(), with chip-level masks
+//  computed at probe. Only for plain push-pull lines.
+//
+// * Instrumentation:
+//  Tracepoints display7:display7_store, display7_decode and
+//  display7_gpio_set_start/end (see display7_trace.h), and
+//  /sys/kernel/debug/display7/<panel-device>/latency with a log2
+//  histogram of the store-to-GPIO latency and the count of failed GPIO
+//  writes.
+//
+// * Micro-benchmark:
+//  echo 100000 > /sys/kernel/debug/display7/<panel-device>/bench
+//  cat /sys/kernel/debug/display7/<panel-device>/bench
+//  times that many commits of the first display (or "<count> <display>"),
+//  cached and uncached, through gpiolib and the fast path, and reports
+//  ns/op, min and max along with the GPIO controller.
+//
+// * Power management:
+//  A panel left blank and idle (no FIFO playing, no marquee, framebuffer
+//  unmapped) is runtime suspended after 'autosuspend-delay-ms' (default
+//  2000 ms, also power/autosuspend_delay_ms of the panel device): the
+//  refresh timer stops and the PWMs and select lines are turned off. The
+//  next write resumes it before going out; the debugfs 'latency' file
+//  shows how often that happened and the slowest wake-up.
 //
 // Framework:
 // * Creates a new /sys/class (display7).
-// * Creates a subdevice for a dislpay within this class.
+// * Creates a subdevice for each dislpay within this class.
+// * Registers a character device (/dev/display7-<N>) for each display.
+// * Any number of panels (platform devices) can be bound at once, each
+//   with its own state and lock. Their displays share the class and the
+//   numbering of /dev/display7-<N> and of default names (user:<N+1>).
+// * Files and mappings of /dev/display7-<N> may outlive their panel:
+//   after unbind every call on them fails with ENODEV.
 //
 //
 // NOTE: 
 // The driver expects one device tree subnode per each display with
 // mandatory 'label' and 'gpios' properties defined.
+// Segment lines are read from 'segment-gpios' or, for older device trees,
+// from 'disp<N>-gpios' where <N> is the 1-based position of the subnode.
+// A "display7:" prefix in 'label' is dropped from <display-name>.
+// Lines are expected in the order a..g, dp unless 'segment-order' gives,
+// for each listed line, its segment (0 = a ... 6 = g, 7 = dp). On
+// multiplexed panels it goes next to the shared 'segment-gpios'.
+//
+// Optional 'commit-groups' (segment masks, e.g. <0x0f 0xf0>) switch the
+// lines of a static display group after group, 'commit-group-delay-ns'
+// (default 200) apart, to cap the current peak of frames like '8'. Both
+// are per display: a commit first switches the displays without groups
+// together, then each display with groups in turn, with its own delay
+// before each of its groups, so no two groups of the panel switch at the
+// same instant. Such displays skip the 'direct-gpio' fast path. BAM
+// planes switch every line of the panel at once, so a panel with any
+// grouped display only dims through PWMs: levels below the maximum that
+// would need BAM fail with EOPNOTSUPP.
 //
 // Example of a valid configuration:
 //
@@ -38,41 +177,540 @@
 //                        <&gpio 23 0>,	/* segment G */
 //                        <&gpio 7 0>;	/* DP */
 //      };
+//
+//      display7_2 {
+//          label = "display7:user:2";
+//          segment-gpios = <&gpio 2 0>, <&gpio 3 0>, <&gpio 4 0>,
+//                          <&gpio 17 0>, <&gpio 27 0>, <&gpio 22 0>,
+//                          <&gpio 10 0>, <&gpio 9 0>;
+//          /* Board wired DP first, then G down to A */
+//          segment-order = <7 6 5 4 3 2 1 0>;
+//      };
+//  };
+//
+// Example of a multiplexed 4 digit module. The segment lines move to the
+// parent node and each display only lists its digit-select line (use
+// GPIO_ACTIVE_LOW when the select line is active low). The refresh rate
+// defaults to 100 Hz.
+//
+//  seven_segment_panel {
+//      compatible = "filhodamain,display7";
+//      scan-mode = "multiplexed";
+//      refresh-rate-hz = <200>;
+//      segment-gpios = <&gpio 15 0>, <&gpio 14 0>, <&gpio 8 0>,
+//                      <&gpio 25 0>, <&gpio 24 0>, <&gpio 18 0>,
+//                      <&gpio 23 0>, <&gpio 7 0>;
+//
+//      digit_1 {
+//          label = "display7:panel:1";
+//          select-gpios = <&gpio 5 GPIO_ACTIVE_LOW>;
+//      };
+//      ...
+//      digit_4 {
+//          label = "display7:panel:4";
+//          select-gpios = <&gpio 26 GPIO_ACTIVE_LOW>;
+//      };
+//  };
+//
+// Panels behind SPI: the compatible picks the output stage, the front
+// end (sysfs, character devices, glyphs) is the same for all of them.
+// "filhodamain,display7-74hc595" drives a chain of shift registers, one
+// per display, the first display being the register next to the
+// controller ('output-active-low' inverts every output, for common anode
+// displays). "filhodamain,display7-max7219" drives a chain of MAX7219,
+// 8 displays per chip from the first chip on; 'brightness' sets the
+// intensity of the chip (the highest of its digits). A commit sends the
+// whole panel in one spi_sync() from the commit workqueue. SPI panels are
+// static, with no BAM and no 'direct-gpio'.
+//
+//  &spi0 {
+//      seven_segment_chain@0 {
+//          compatible = "filhodamain,display7-max7219";
+//          reg = <0>;
+//          spi-max-frequency = <10000000>;
+//
+//          digit_1 {
+//              label = "display7:chain:1";
+//          };
+//          ...
+//      };
 //  };
 //
 
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/ctype.h>
+#include <linux/version.h>
 #include <linux/slab.h>
 #include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/kref.h>
+#include <linux/uaccess.h>
+#include <linux/delay.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/sched/signal.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/bitmap.h>
+#include <linux/kfifo.h>
+#include <linux/list.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/bitrev.h>
+#include <linux/of.h>
+#include <linux/property.h>
 #include <linux/gpio.h>
 #include <linux/gpio/consumer.h>
+#include <linux/gpio/driver.h>
 #include <linux/platform_device.h>
+#include <linux/spi/spi.h>
+#include <linux/pm_runtime.h>
+#include <linux/pwm.h>
 #include <linux/of_gpio.h>
 
+#include "display7.h"
+
+#define CREATE_TRACE_POINTS
+#include "display7_trace.h"
+
 
 #define DRIVER_NAME             "display7"
 #define SYSCLASS_NAME           "display7"
-#define DISPLAY_DEVICE_NAME     "user:1"
+#define DISPLAY_DEVICE_NAME_FMT "user:%u"
+#define LABEL_PREFIX            "display7:"
+#define CHRDEV_NAME_FMT         "display7-%u"
+
+// Limits of a panel
+#define MAX_DISPLAYS            32      // Per panel
+#define DISPLAY7_MINORS         256     // All panels together
+#define MAX_SEGMENTS            8       // a..g and dp
+
+// Refresh engine (multiplexing and brightness)
+#define DEFAULT_REFRESH_HZ      100
+#define MAX_REFRESH_HZ          10000
+#define GOVERNOR_HOLD_MS        1000    // Stable content before dropping the rate
+#define MAX_BRIGHTNESS          15
+#define BAM_PLANES              4       // Bits per brightness level
+#define BAM_UNITS               ((1 << BAM_PLANES) - 1)
+#define MIN_BAM_UNIT_NS         (10 * NSEC_PER_USEC)
+
+// Staggered commits ('commit-groups'): line groups switched one after the
+// other to spread the inrush current
+#define MAX_COMMIT_GROUPS       MAX_SEGMENTS
+#define DEFAULT_GROUP_DELAY_NS  200
+#define MAX_GROUP_DELAY_NS      10000
+#define DESC_UNGROUPED          0xFF    // Line of a display without groups
+
+// MAX7219 backend: digits per chip and registers
+#define MAX7219_DIGITS          8
+#define MAX7219_CHIPS           DIV_ROUND_UP(MAX_DISPLAYS, MAX7219_DIGITS)
+#define MAX7219_REG_NOOP        0x00
+#define MAX7219_REG_DIGIT0      0x01
+#define MAX7219_REG_DECODE      0x09
+#define MAX7219_REG_INTENSITY   0x0A
+#define MAX7219_REG_SCAN_LIMIT  0x0B
+#define MAX7219_REG_SHUTDOWN    0x0C
+#define MAX7219_REG_TEST        0x0F
+
+// Decimal point bit of a segment mask
+#define SEGMENT_DP              BIT(7)
+
+// Marquee scroll of long strings
+#define MAX_TEXT_CELLS          64
+#define DEFAULT_SCROLL_MS       300
+#define MIN_SCROLL_MS           10
+#define MAX_SCROLL_MS           10000
+
+// Glyph table: one entry per ASCII character
+#define NGLYPHS                 128
+#define GLYPH_FALLBACK          BIT(8)  // No glyph, shown as '8'
+
+// Frames copied from user space per chunk in display7_write()
+#define WRITE_CHUNK_FRAMES      16
+
+// Dwell times from this value on sleep interruptibly in milliseconds
+#define DWELL_MSLEEP_US         20000
+
+// Store-to-GPIO latency histogram: log2 buckets of nanoseconds
+#define LATENCY_BUCKETS         32
+
+// debugfs 'bench': commits per run, and runs kept (path x cached/uncached)
+#define MAX_BENCH_OPS           1000000
+#define BENCH_RUNS              4
+
+// Idle time of a blank panel before it is runtime suspended
+#define DEFAULT_AUTOSUSPEND_MS  2000
+
+// Playback FIFO entries per display (power of 2)
+#define FIFO_LEN                256
+#define FIFO_MIN_DURATION_US    50
+
+// Triple buffered scan frames: index of the frame handed to the refresh
+// timer, flagged until the timer takes it
+#define SCAN_FRAMES             3
+#define SCAN_FRAME_INDEX        0x3
+#define SCAN_FRAME_FRESH        0x4
 
+// Longest DISPLAY7_IOC_WAIT_VSYNC wait for the next scan cycle (a cycle
+// takes up to a second at the lowest rate)
+#define VSYNC_TIMEOUT_MS        2000
+
+// Commits kept per display for the readers of /dev/display7-<N> (power
+// of 2). A reader that falls behind loses its oldest events.
+#define HISTORY_LEN             256
+
+// Framebuffer refresh tick while the shared page is mapped (0 = doorbell
+// only). The parameter is declared along with the tick.
+static unsigned int fb_refresh_ms = 10;
+
+// Published state of a display.
+// Written under the panel lock, read locklessly through display7_read_state().
+struct display7_state_st {
+    char digit;                 // Requested character (0 for raw masks)
+    u8 segments;                // Committed segment mask
+    u32 seq;                    // Commit sequence number
+    ktime_t timestamp;          // Time of the commit
+};
+
+// Counters of a display, kept per CPU so the write paths never share a
+// cache line for them, and summed when 'stats' is read
+enum display7_stat {
+    STAT_WRITES,                // Characters and masks requested by user space
+    STAT_DECODE_FALLBACKS,      // Characters without a glyph, shown as '8'
+    STAT_CACHE_HITS,            // Commits the lines already showed
+    STAT_CACHE_MISSES,
+    STAT_COALESCED,             // Deferred commits merged into a later one
+    STAT_GPIO_ERRORS,           // Failed GPIO writes of the display
+    NR_STATS,
+};
+
+struct display7_pcpu_stats_st {
+    u64_stats_t counters[NR_STATS];
+    struct u64_stats_sync syncp;
+};
+
+struct display7_data_st;
+
+// One per open /dev/display7-<N>
+struct display7_reader_st {
+    struct display7_data_st * disp;
+    u32 pos;                    // Next commit to read, as disp->history_head
+};
+
+// One per display (device tree subnode)
 struct display7_data_st {
+    struct display7_panel_st * panel;
+    unsigned int index;
+    const char * name;
     dev_t devnum;
+    struct cdev cdev;
+    struct device dev;          // Holds a reference to the panel
+
+    char digit;                 // 0 when showing a raw framebuffer mask
+    unsigned long pending;      // Segment mask of the next commit
+    bool held;                  // 'pending' from a DISPLAY7_FRAME_DEFER frame
+    u8 fb_shadow;               // Last mask picked up from the framebuffer
+
+    seqcount_spinlock_t state_seq;      // Tied to the panel lock
+    struct display7_state_st state;
+    ktime_t requested;          // Store of the pending mask (0 = none)
+    pid_t writer;               // Process behind the pending mask (0 = kernel)
+
+    // Change notifications: sysfs_notify() on 'digit' and the commit
+    // history streamed by the open character devices. Records are
+    // written under the panel lock, 'history_head' counts them all.
+    struct kernfs_node * digit_kn;
+    struct display7_event * history;    // HISTORY_LEN records
+    u32 history_head;
+    wait_queue_head_t wait;
+
+    // Playback FIFO, entries consumed by 'fifo_timer' under the panel lock
+    DECLARE_KFIFO(fifo, struct display7_fifo_entry, FIFO_LEN);
+    struct hrtimer fifo_timer;
+    struct mutex fifo_lock;     // Serialises pushes and flushes
+    bool fifo_running;          // Timer armed
+    bool fifo_loop;             // Played entries go back to the tail
+    bool fifo_end;              // Running dry is not an underrun
+    unsigned int fifo_underruns;
+
+    // Last committed mask. Commits only touch the lines that differ from
+    // it and are skipped altogether when nothing changed.
+    unsigned long latched;
+    bool latched_valid;         // Cleared when a GPIO write failed
+    bool dirty;                 // Deferred commit queued
+
+    struct display7_pcpu_stats_st __percpu * stats;
+
+    // Static mode: own segment lines
+    unsigned int nsegments;
+    unsigned long line_mask;    // Bits of 'pending' backed by a line
+    struct gpio_desc * segments[MAX_SEGMENTS];
+
+    // Commit group of each line ('commit-groups'), all 0 without them
+    u8 line_group[MAX_SEGMENTS];
+    bool staggered;             // More than one group
+    unsigned int ngroups;
+    unsigned int group_delay_ns;
+
+    // Masks as wired ('segment-order'), NULL for the a..g, dp order.
+    // Shared by all displays of a multiplexed panel.
+    const u8 * remap;
+
+    // Fast path: every line on 'fast_chip', written straight through its
+    // set_multiple(). fast_bits[] holds the chip-level levels of each
+    // segment mask (active-low already applied) within 'fast_mask'.
+    struct gpio_chip * fast_chip;
+    unsigned long fast_mask;
+    unsigned long * fast_bits;
+
+    // Multiplexed mode: digit-select line
+    struct gpio_desc * select;
+
+    // Brightness, 0 to MAX_BRIGHTNESS. The display level drives 'pwm' if
+    // the display has one, software BAM otherwise.
+    u8 brightness;
+    u8 segment_brightness[MAX_SEGMENTS];
+    u8 plane_mask[BAM_PLANES];  // Segments lit in each BAM plane
+    bool bam;                   // Some segment below full brightness
+    struct pwm_device * pwm;
+};
+
+enum display7_scan_mode {
+    SCAN_STATIC,        // Every display has its own, latched, segment lines
+    SCAN_MULTIPLEXED,   // Shared segment lines, one select line per display
+};
+
+// Timing of the multiplexed scan, as seen from the hrtimer callback
+struct display7_scan_stats_st {
+    u64 ticks;
+    u64 overruns;               // Slots skipped because the timer fired late
+    s64 jitter_min_ns;
+    s64 jitter_max_ns;
+    u64 jitter_sum_ns;
+};
+
+// One run of the debugfs 'bench' trigger
+struct display7_bench_st {
+    const char * path;          // Backend name or "fast"
+    bool cached;                // Same mask every commit
+    u64 ops;
+    u64 total_ns;
+    u64 min_ns;
+    u64 max_ns;
+};
+
+// Fast path lines of one chip written by a commit of several displays
+struct display7_fast_write_st {
+    struct gpio_chip * chip;
+    unsigned long mask;
+    unsigned long bits;
+    unsigned int nlines;        // For the tracepoints
+};
+
+// A character of a string as shown on one display
+struct display7_cell_st {
     char digit;
-    struct gpio_descs * descs;
+    u8 segments;
+};
+
+struct display7_panel_st;
+
+// Output stage of a panel, picked by the compatible of its node.
+// Backends that can't write from atomic context run deferred: commits
+// only reach them through the commit work. Immediate commits, the fast
+// path, BAM and multiplexing are GPIO only.
+struct display7_backend_ops {
+    const char * name;
+    bool multiplexed;           // Can scan the displays ('scan-mode')
+
+    // Reads what drives one display: its lines, its place on the bus
+    int (*parse_display)(struct device_node *np, struct display7_data_st *disp);
+    // Once every display is parsed
+    int (*init)(struct display7_panel_st *panel);
+
+    // Deferred commit of the displays in 'dirty'. prepare() runs under
+    // the panel lock: it latches their pending masks, drops the displays
+    // already showing them and returns how much write() has to send
+    // (0 for nothing). write() runs unlocked and may sleep.
+    unsigned int (*prepare)(struct display7_panel_st *panel, unsigned long *dirty);
+    int (*write)(struct display7_panel_st *panel, unsigned int n);
+
+    // Optional hardware dimming by display level, may sleep
+    int (*set_brightness)(struct display7_data_st *disp);
+    // Optional, on runtime suspend (off) and resume (on), may sleep
+    int (*power)(struct display7_panel_st *panel, bool on);
 };
-static struct display7_data_st * display7_data;
 
-// From probe()
-static struct device *parent_device = NULL;
+// All displays driven by the controller (drvdata of the platform or SPI
+// device). Open files, mappings and the display devices hold a
+// reference to it, so it and its displays outlive the binding. Past
+// unbind only the panel and display structures, the histories and the
+// counters are left.
+struct display7_panel_st {
+    struct kref kref;
+    struct device * dev;
+    unsigned int ndisplays;
+    struct display7_data_st * displays;
+    const struct display7_backend_ops * backend;
+
+    spinlock_t lock;            // Serialises GPIO commits and display state
+
+    // Unbound, under the lock: the file operations fail with -ENODEV.
+    // They run with 'ops_lock' held for reading so that unbind can wait
+    // for the ones already past the check.
+    bool dead;
+    struct rw_semaphore ops_lock;
+
+    // Segment lines (and levels) collected for one gpiod_set_array_value()
+    // call, sized for every line of the panel
+    unsigned int ndescs;
+    struct gpio_desc ** descs;
+    unsigned long * values;
+
+    // Staggered commits: display (DESC_UNGROUPED without groups) and
+    // commit group of each gathered line, and the lines of the group
+    // being written. Without any staggered display everything is written
+    // at once.
+    bool staggered;
+    u8 * desc_disp;
+    u8 * desc_group;
+    struct gpio_desc ** group_descs;
+    unsigned long * group_values;
+
+    // Fast path: one chip write per chip and commit, at most one per
+    // display with a fast path
+    struct display7_fast_write_st * fast_writes;
+
+    // Every segment line of a static panel, display after display,
+    // driven as a whole by the refresh timer during BAM
+    unsigned int nlines;
+    struct gpio_desc ** lines;
+    unsigned long * line_values;
+
+    // Deferred commits (sleeping GPIO controllers, SPI backends). Writers
+    // mark their display dirty and the work outputs whatever is pending
+    // by then.
+    bool deferred;
+    struct workqueue_struct * commit_wq;
+    struct work_struct commit_work;
+
+    // SPI backends: the whole panel goes out in one spi_sync(). The
+    // buffers are only written by the commit work, so outside the lock.
+    struct spi_device * spi;
+    u8 * spi_tx;                        // DMA-safe, one MAX7219 row after the other
+    unsigned int spi_len;               // Bytes per transfer
+    struct spi_transfer * spi_xfers;    // MAX7219: one per digit row
+    bool spi_active_low;                // 74HC595 outputs sink the segment current
+    unsigned int max7219_chips;
 
-// User-space interface:
+    // Shared framebuffer (one page, one byte per display)
+    u8 * fb;
+    atomic_t fb_users;          // Live mappings of the page
+    struct delayed_work fb_work;
+
+    // Refresh engine. Multiplexed panels always run it, static panels
+    // only while some display needs BAM for its brightness.
+    enum display7_scan_mode scan_mode;
+    struct gpio_descs * scan_segments;  // Shared segment lines (multiplexed)
+    const u8 * scan_remap;              // Their 'segment-order'
+    unsigned int scan_pos;              // Display currently selected
+    unsigned int scan_plane;            // BAM plane being output
+    unsigned int refresh_hz;            // Full panel cycles per second (maximum)
+    unsigned int refresh_hz_min;        // Governor floor, 'refresh_hz' for a fixed rate
+    ktime_t scan_slot;                  // Time each display stays lit
+    ktime_t bam_unit;                   // Shortest BAM slice of a slot
+    bool bam;                           // Some display needs BAM
+    struct hrtimer scan_timer;
+
+    // Committed mask of each display. Commits fill the back frame under
+    // the lock. On multiplexed panels it is then handed over through
+    // 'scan_ready' and the timer swaps it in at the start of a cycle, so
+    // the timer never takes the lock against writers. Static panels only
+    // ever use the back frame.
+    u8 scan_frames[SCAN_FRAMES][MAX_DISPLAYS];
+    u8 * scan_frame;                    // Back frame
+    unsigned int scan_back;
+    bool scan_dirty;                    // Back frame changed since handed over
+    bool scan_batch;                    // Hand-over held until the commit is whole
+    atomic_t scan_ready;                // SCAN_FRAME_INDEX | SCAN_FRAME_FRESH
+    unsigned int scan_front;            // Frame being scanned (timer only)
+    unsigned int scan_cycles;           // Cycles started (DISPLAY7_IOC_WAIT_VSYNC)
+    wait_queue_head_t scan_wait;
+
+    // Refresh governor of multiplexed panels, timer only: the rate in
+    // use and its timing, and the last cycle that brought a new frame
+    unsigned int gov_hz;
+    ktime_t gov_slot;
+    ktime_t gov_unit;
+    ktime_t gov_changed;
+
+    // What the lockless timer reads of the timing and brightness
+    // settings, written under the lock
+    seqcount_spinlock_t scan_seq;
+
+    // Written by the timer only, restarted on its next tick on request
+    struct display7_scan_stats_st scan_stats;
+    seqcount_t scan_stats_seq;
+    bool scan_stats_reset;
+    struct mutex config_lock;           // Serialises brightness changes and benchmarks
+
+    // Instrumentation (debugfs), under the lock
+    struct dentry * debugfs;
+    u64 latency_hist[LATENCY_BUCKETS];  // Bucket b: [2^b, 2^(b+1)) ns
+    u64 pm_resumes;
+    u64 pm_resume_max_ns;               // Slowest runtime resume
+
+    // Last debugfs 'bench' results, under the config lock
+    struct display7_bench_st bench[BENCH_RUNS];
+    unsigned int nbench;
+    unsigned int bench_index;           // Display benchmarked
+
+    // Runtime PM. The panel holds a reference of its own while anything
+    // is lit or updates the displays by itself (see display7_pm_update()),
+    // so it only suspends once blank and idle. Under the lock.
+    unsigned int nlit;                  // Displays with a non-blank mask
+    unsigned int fifos_running;         // Displays playing their FIFO
+    bool pm_held;
+
+    // Segment mask of each ASCII character, GLYPH_FALLBACK if it has none
+    u16 glyphs[NGLYPHS];
+
+    // Marquee: a string too long for displays [scroll_first, ndisplays)
+    // loops through them, followed by one blank cell
+    struct display7_cell_st scroll_cells[MAX_TEXT_CELLS];
+    unsigned int scroll_len;            // 0 when not scrolling
+    unsigned int scroll_first;
+    unsigned int scroll_pos;            // Cell shown on scroll_first
+    pid_t scroll_writer;                // Process that queued it
+    unsigned int scroll_ms;             // Step time
+    struct delayed_work scroll_work;
+};
+
+// User-space interface, shared by every panel:
 // ----------------------------------------------
 // A class to appear in /sys/class/
+// Its devices ("objects / instances") are display7_data_st::dev
 static struct class * display7_class = NULL;
 
-// An "object / instance" of class display7_class
-static struct device * sysfs_display7_device = NULL;
+// Character device numbers, one minor per display of any panel
+static dev_t display7_devbase;
+static DEFINE_IDA(display7_minors);
+
+// /sys/kernel/debug/display7/, one directory per panel
+static struct dentry * display7_debugfs;
 // ----------------------------------------------
 
 // Segments:
@@ -107,184 +745,4228 @@ static unsigned long segment_table[] = {
     0x71    // F: g,f,e,a
 };
 
-static void display7_setled(unsigned int digit)
+// Glyphs beyond the hex digits of segment_table[]
+static const struct {
+    char c;
+    u8 segments;
+} extra_glyphs[] = {
+    { 'H', 0x76 },  // g,f,e,c,b
+    { 'h', 0x74 },  // g,f,e,c
+    { 'J', 0x1E },  // e,d,c,b
+    { 'L', 0x38 },  // f,e,d
+    { 'n', 0x54 },  // g,e,c
+    { 'o', 0x5C },  // g,e,d,c
+    { 'P', 0x73 },  // g,f,e,b,a
+    { 'r', 0x50 },  // g,e
+    { 't', 0x78 },  // g,f,e,d
+    { 'U', 0x3E },  // f,e,d,c,b
+    { 'u', 0x1C },  // e,d,c
+    { 'y', 0x6E },  // g,f,d,c,b
+    { '-', 0x40 },  // g
+    { '_', 0x08 },  // d
+    { '=', 0x48 },  // g,d
+    { '*', 0x63 },  // g,f,b,a (degree)
+    { ' ', 0x00 },  // blank
+};
+
+// Fills the glyph table with the built-in glyphs
+static void display7_glyphs_init(u16 *glyphs)
 {
-    // Sanity check
-    if (digit > 15)
+    unsigned int i;
+
+    for (i = 0; i < NGLYPHS; i++)
     {
-        return;
+        glyphs[i] = GLYPH_FALLBACK | segment_table[8];
     }
 
-    unsigned long digit_segments = segment_table[digit];
-    int result = gpiod_set_array_value( display7_data->descs->ndescs,
-                                    display7_data->descs->desc,
-                                    display7_data->descs->info,
-                                    &digit_segments);
+    for (i = 0; i < 10; i++)
+    {
+        glyphs['0' + i] = segment_table[i];
+    }
+    for (i = 10; i < 16; i++)
+    {
+        glyphs['a' + i - 10] = segment_table[i];
+        glyphs['A' + i - 10] = segment_table[i];
+    }
 
-    if (IS_ERR(result))
+    for (i = 0; i < ARRAY_SIZE(extra_glyphs); i++)
     {
-        dev_err(parent_device, "Error setting a value in GPIOS: %d", result);
+        glyphs[(unsigned char) extra_glyphs[i].c] = extra_glyphs[i].segments;
     }
 }
 
-// User space interface for "read" callbacks to special file
-static ssize_t digit_show(struct device *dev,
-            struct device_attribute *attr, char *buf)
+// Per-CPU counters
+// ----------------------------------------------
+// Safe from any context: the update is bracketed for 32-bit readers and
+// runs with interrupts off where a tick could nest into it
+static void display7_stat_add(struct display7_data_st *disp, enum display7_stat stat, u64 n)
+{
+    struct display7_pcpu_stats_st *stats = get_cpu_ptr(disp->stats);
+    unsigned long flags;
+
+    flags = u64_stats_update_begin_irqsave(&stats->syncp);
+    u64_stats_add(&stats->counters[stat], n);
+    u64_stats_update_end_irqrestore(&stats->syncp, flags);
+    put_cpu_ptr(disp->stats);
+}
+
+static void display7_stat_inc(struct display7_data_st *disp, enum display7_stat stat)
+{
+    display7_stat_add(disp, stat, 1);
+}
+
+// Adds up the counters of every CPU
+static void display7_stats_sum(struct display7_data_st *disp, u64 *sum)
+{
+    unsigned int i, start;
+    int cpu;
+
+    memset(sum, 0, NR_STATS * sizeof(*sum));
+    for_each_possible_cpu(cpu)
+    {
+        struct display7_pcpu_stats_st *stats = per_cpu_ptr(disp->stats, cpu);
+        u64 counters[NR_STATS];
+
+        do
+        {
+            start = u64_stats_fetch_begin(&stats->syncp);
+            for (i = 0; i < NR_STATS; i++)
+            {
+                counters[i] = u64_stats_read(&stats->counters[i]);
+            }
+        } while (u64_stats_fetch_retry(&stats->syncp, start));
+
+        for (i = 0; i < NR_STATS; i++)
+        {
+            sum[i] += counters[i];
+        }
+    }
+}
+// ----------------------------------------------
+
+// Returns the segment mask of a character.
+// Characters without a glyph are replaced by '8'.
+static u8 display7_decode(struct display7_data_st *disp, char *digit)
+{
+    unsigned int c = (unsigned char) *digit;
+    u16 glyph = GLYPH_FALLBACK | segment_table[8];
+
+    if (c < NGLYPHS)
+    {
+        glyph = READ_ONCE(disp->panel->glyphs[c]);
+    }
+    if (glyph & GLYPH_FALLBACK)
+    {
+        *digit = '8';
+        display7_stat_inc(disp, STAT_DECODE_FALLBACKS);
+    }
+    trace_display7_decode(c, *digit, glyph & 0xFF);
+
+    return glyph & 0xFF;
+}
+
+// Turns a segment mask ([dp] [g] ... [a]) into the levels of the lines
+// of a display, in the order its GPIOS are listed
+static unsigned long display7_wire(struct display7_data_st *disp, unsigned long segments)
+{
+    return disp->remap ? disp->remap[segments & 0xFF] : segments;
+}
+
+// Appends the lines of a display whose level in 'segments' differs from
+// the latched mask to descs[]/values at position 'n'. Returns how many
+// lines were added, none (a cache hit) if the display already shows it.
+// Called with the panel lock held.
+static unsigned int display7_gather_changes(struct display7_data_st *disp, unsigned long segments,
+        struct gpio_desc **descs, unsigned long *values, unsigned int n)
+{
+    unsigned long pending = display7_wire(disp, segments) & disp->line_mask;
+    unsigned long changed;
+    unsigned int s, added = 0;
+
+    changed = disp->latched_valid ? (pending ^ disp->latched) : disp->line_mask;
+    if (!changed)
+    {
+        display7_stat_inc(disp, STAT_CACHE_HITS);
+        return 0;
+    }
+    display7_stat_inc(disp, STAT_CACHE_MISSES);
+
+    for_each_set_bit(s, &changed, disp->nsegments)
+    {
+        descs[n + added] = disp->segments[s];
+        __assign_bit(n + added, values, pending & BIT(s));
+        disp->panel->desc_disp[n + added] = disp->staggered ? disp->index : DESC_UNGROUPED;
+        disp->panel->desc_group[n + added] = disp->line_group[s];
+        added++;
+    }
+
+    disp->latched = pending;
+    disp->latched_valid = true;
+    return added;
+}
+
+// Process behind a request, as recorded in the history. Timers and
+// kernel threads show as 0.
+static pid_t display7_current_writer(void)
 {
-    *buf = display7_data->digit;
+    if (in_task() && !(current->flags & PF_KTHREAD))
+    {
+        return task_tgid_nr(current);
+    }
     return 0;
 }
 
-// User space interface for "write" callbacks to special file
-static ssize_t digit_store(struct device *dev,
-        struct device_attribute *attr, const char *buf, size_t size)
+// Remembers the current process as the source of the display's next
+// commits, and counts the 'n' frames it requested
+static void display7_account_request(struct display7_data_st *disp, unsigned int n)
 {
-    char digit = *buf;
-
-    // Basic stupid conversion
-    switch (digit)
-    {
-        case '0': display7_setled(0); break;
-        case '1': display7_setled(1); break;
-        case '2': display7_setled(2); break;
-        case '3': display7_setled(3); break;
-        case '4': display7_setled(4); break;
-        case '5': display7_setled(5); break;
-        case '6': display7_setled(6); break;
-        case '7': display7_setled(7); break;
-        case '8': display7_setled(8); break;
-        case '9': display7_setled(9); break;
-        case 'a': display7_setled(10); break;
-        case 'b': display7_setled(11); break;
-        case 'c': display7_setled(12); break;
-        case 'd': display7_setled(13); break;
-        case 'e': display7_setled(14); break;
-        case 'f': display7_setled(15); break;
-        default: digit = '8'; display7_setled(8);
-    }
-
-    display7_data->digit = digit;
-    return size;
+    WRITE_ONCE(disp->writer, display7_current_writer());
+    display7_stat_add(disp, STAT_WRITES, n);
 }
 
-// Delcares 'dev_attr_digit' of type 'struct device_attribute'.
-// Fills the store/show callbacks with 'digit_store()', 'digit_show()'.
-static DEVICE_ATTR_RW(digit);
+// Records a commit in the display's history and wakes up its readers.
+// The cost doesn't depend on the number of readers: they all stream from
+// the same ring. Called with the panel lock held, possibly from interrupt
+// context.
+static void display7_notify(struct display7_data_st *disp)
+{
+    struct display7_event *event;
 
-static int display7_probe(struct platform_device *pdev)
+    event = &disp->history[disp->history_head & (HISTORY_LEN - 1)];
+    event->timestamp_ns = ktime_to_ns(disp->state.timestamp);
+    event->seq = disp->state.seq;
+    event->digit = disp->state.digit;
+    event->segments = disp->state.segments;
+    event->pid = READ_ONCE(disp->writer);
+
+    // Readers check the head without the lock before sleeping
+    WRITE_ONCE(disp->history_head, disp->history_head + 1);
+    if (wq_has_sleeper(&disp->wait))
+    {
+        wake_up_interruptible(&disp->wait);
+    }
+
+    if (disp->digit_kn)
+    {
+        sysfs_notify_dirent(disp->digit_kn);
+    }
+}
+
+// Runtime PM
+// ----------------------------------------------
+// Takes or drops the panel's own reference as it turns busy or idle.
+// Called with the panel lock held, possibly from the timers: getting is
+// asynchronous (writers resume the panel beforehand, see display7_pm_get())
+// and dropping only arms the autosuspend timer.
+static void display7_pm_update(struct display7_panel_st *panel)
 {
-    parent_device = &pdev->dev;
-    struct device_node *np = pdev->dev.of_node; // Parent
-    struct device_node *child = NULL;           // Child device-tree node
-    struct device * child_device;               // Child device
-    int result;
+    bool busy = panel->nlit || panel->fifos_running || panel->scroll_len ||
+                atomic_read(&panel->fb_users);
 
-    display7_data = devm_kzalloc(parent_device, sizeof(*display7_data), GFP_KERNEL);
-    if (!display7_data)
+    if (busy == panel->pm_held)
     {
-        return -ENOMEM;
+        return;
+    }
+
+    panel->pm_held = busy;
+    if (busy)
+    {
+        pm_runtime_get(panel->dev);
+    }
+    else
+    {
+        pm_runtime_mark_last_busy(panel->dev);
+        pm_runtime_put_autosuspend(panel->dev);
+    }
+}
+
+// Resumes the panel for a write from process context, so the write
+// reaches running lines. Balanced by display7_pm_put().
+static int display7_pm_get(struct display7_panel_st *panel)
+{
+    return pm_runtime_resume_and_get(panel->dev);
+}
+
+static void display7_pm_put(struct display7_panel_st *panel)
+{
+    pm_runtime_mark_last_busy(panel->dev);
+    pm_runtime_put_autosuspend(panel->dev);
+}
+// ----------------------------------------------
+
+// Publishes the character and mask being committed.
+// Called with the panel lock held, so writers never wait on readers.
+static void display7_publish(struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+
+    if (!disp->state.segments != !disp->pending)
+    {
+        if (disp->pending)
+        {
+            panel->nlit++;
+        }
+        else
+        {
+            panel->nlit--;
+        }
+        display7_pm_update(panel);
     }
 
-    // Get the child display device in two steps.
-    // (1) Get child device tree (dt) node (we use dt nodes to traverse the device-tree)
-    // (2) Since dt node is a member of device struct we can get it using container_of()
-    child = of_get_next_child(np, NULL);    // DT node
-    child_device = container_of(&child, struct device, of_node);    // Child device
+    disp->held = false;
 
-    // Get from device tree an array of gpios named "disp1-gpios".
-    // gpiod_get_array() automatically converts to the gpio descriptor form and
-    // sets direction to Output and level to Low (0)
-    display7_data->descs = gpiod_get_array(child_device, "disp1", GPIOD_OUT_LOW);
-    if (IS_ERR(display7_data->descs))
+    write_seqcount_begin(&disp->state_seq);
+    disp->state.digit = disp->digit;
+    disp->state.segments = disp->pending;
+    disp->state.seq++;
+    disp->state.timestamp = ktime_get();
+    write_seqcount_end(&disp->state_seq);
+
+    // Commits not started from a store count from here
+    if (!disp->requested)
     {
-        dev_err(parent_device, "Error getting array og GPIOS: %d", display7_data->descs);
-        return (int) display7_data->descs;
+        disp->requested = disp->state.timestamp;
     }
 
-    // Define a custom user-space interface 
-    // -----------------------------------------------------------------
-    // Allocate a Major Number
-    // After success call, display7_data.devnum represents a unique
-    // MAJOR | MINOR number
-    result = alloc_chrdev_region(&display7_data->devnum, 0, 1, DRIVER_NAME);
-    if (result)
+    display7_notify(disp);
+}
+
+// Takes a consistent snapshot of the published state without locking
+static void display7_read_state(struct display7_data_st *disp, struct display7_state_st *state)
+{
+    unsigned int seq;
+
+    do
     {
-        dev_err(parent_device,"Failed to allocate device number");
-        goto ret_err_alloc_chrdev_region;
+        seq = read_seqcount_begin(&disp->state_seq);
+        *state = disp->state;
+    } while (read_seqcount_retry(&disp->state_seq, seq));
+}
+
+// Latches 'segments' for the fast path of a display and returns its
+// chip-level levels in 'bits', unless the lines already show it.
+// Returns true if the lines need a write.
+// Called with the panel lock held.
+static bool display7_fast_latch(struct display7_data_st *disp, unsigned long segments,
+        unsigned long *bits)
+{
+    segments = display7_wire(disp, segments) & disp->line_mask;
+    if (disp->latched_valid && disp->latched == segments)
+    {
+        display7_stat_inc(disp, STAT_CACHE_HITS);
+        return false;
     }
+    display7_stat_inc(disp, STAT_CACHE_MISSES);
 
-    // Create a class of devices to appear in /sys/class/
-    display7_class = class_create(THIS_MODULE, SYSCLASS_NAME);
-    if (IS_ERR(display7_class))
+    *bits = disp->fast_bits[segments];
+    disp->latched = segments;
+    disp->latched_valid = true;
+    return true;
+}
+
+// Writes the lines of a display with its fast path, skipping the write
+// when they already show 'segments'. Returns true if the lines were written.
+// Called with the panel lock held.
+static bool display7_fast_commit(struct display7_data_st *disp, unsigned long segments)
+{
+    unsigned long bits;
+
+    if (!display7_fast_latch(disp, segments, &bits))
     {
-        result = PTR_ERR(display7_class);
-        goto ret_err_class_create;
+        return false;
     }
 
-    // Create a device inside /sys/class/display7/
-    sysfs_display7_device = device_create( display7_class, NULL,     /* no parent device */ 
-                            display7_data->devnum, NULL,    /* no additional data */
-                            DISPLAY_DEVICE_NAME );
+    trace_display7_gpio_set_start(disp->nsegments);
+    disp->fast_chip->set_multiple(disp->fast_chip, &disp->fast_mask, &bits);
+    trace_display7_gpio_set_end(disp->nsegments, 0);
+    return true;
+}
+
+// Adds the pending mask of a display to the write of its chip, so a
+// commit of several displays costs one set_multiple() per chip.
+// 'nwrites' counts the chips queued so far. Returns true if the display
+// has lines to write.
+// Called with the panel lock held.
+static bool display7_fast_queue(struct display7_data_st *disp, unsigned int *nwrites)
+{
+    struct display7_panel_st *panel = disp->panel;
+    struct display7_fast_write_st *write;
+    unsigned long bits;
+    unsigned int w;
 
-    if (IS_ERR(sysfs_display7_device))
+    if (!display7_fast_latch(disp, disp->pending, &bits))
     {
-        result = PTR_ERR(sysfs_display7_device);
-        dev_err(parent_device, "Failed to create a device file!");
-        goto ret_err_create_device;
+        return false;
     }
 
-    // Add subfile to directory entry.
-    // Echo'ing and cat'ting this file will call *_store() and *_show()
-    // functions respectively.
-    result = device_create_file(sysfs_display7_device, &dev_attr_digit);
-    if (IS_ERR(result))
+    for (w = 0; w < *nwrites && panel->fast_writes[w].chip != disp->fast_chip; w++)
     {
-        dev_err(parent_device, "Failed to create a device sub-file!");
-        goto ret_err_create_device_subfile;
     }
-    // ------------------------------------------------------------------
+    write = &panel->fast_writes[w];
+    if (w == *nwrites)
+    {
+        write->chip = disp->fast_chip;
+        write->mask = 0;
+        write->bits = 0;
+        write->nlines = 0;
+        (*nwrites)++;
+    }
+    write->mask |= disp->fast_mask;
+    write->bits |= bits;
+    write->nlines += disp->nsegments;
+    return true;
+}
 
-    dev_info(parent_device, "Driver initialized.");
-    goto ret_ok;
+// Issues the chip writes queued by display7_fast_queue()
+static void display7_fast_flush(struct display7_panel_st *panel, unsigned int nwrites)
+{
+    unsigned int w;
 
-ret_err_create_device_subfile:
-    device_destroy(display7_class, display7_data->devnum);
-ret_err_create_device:
-    class_destroy(display7_class);
-ret_err_class_create:
-    unregister_chrdev_region(display7_data->devnum, 1);
-ret_err_alloc_chrdev_region:
-ret_ok:
-    return result;
+    for (w = 0; w < nwrites; w++)
+    {
+        struct display7_fast_write_st *write = &panel->fast_writes[w];
+
+        trace_display7_gpio_set_start(write->nlines);
+        write->chip->set_multiple(write->chip, &write->mask, &write->bits);
+        trace_display7_gpio_set_end(write->nlines, 0);
+    }
 }
 
-static int display7_remove(struct platform_device *pdev)
+static int display7_gpio_set_array(unsigned int n, struct gpio_desc **descs,
+        unsigned long *values, bool cansleep)
 {
-    device_remove_file(sysfs_display7_device, &dev_attr_digit);
-    device_destroy(display7_class, display7_data->devnum);
-    class_destroy(display7_class);
-    unregister_chrdev_region(display7_data->devnum, 1);
-    gpiod_put_array(display7_data->descs);
-    dev_info(&pdev->dev, "Driver unloaded!");
-    return 0;
+    if (cansleep)
+    {
+        return gpiod_set_array_value_cansleep(n, descs, NULL, values);
+    }
+    return gpiod_set_array_value(n, descs, NULL, values);
 }
 
-static const struct of_device_id of_display7_match[] = {
-    {.compatible = "filhodamain,display7"},
-    {},
-};
+// Collects the gathered lines of group 'g' of display 'd' (DESC_UNGROUPED
+// for the displays without groups) for one write. Returns how many.
+static unsigned int display7_gather_group(struct display7_panel_st *panel, unsigned int n,
+        unsigned int d, unsigned int g)
+{
+    unsigned int i, k = 0;
 
-static struct platform_driver display7_driver = {
-    .driver = {
-        .name = DRIVER_NAME,
-        .owner = THIS_MODULE,
-        .of_match_table = of_display7_match,
-    },
-    .probe = display7_probe,
-    .remove = display7_remove,
-};
+    for (i = 0; i < n; i++)
+    {
+        if (panel->desc_disp[i] == d && panel->desc_group[i] == g)
+        {
+            panel->group_descs[k] = panel->descs[i];
+            __assign_bit(k, panel->group_values, test_bit(i, panel->values));
+            k++;
+        }
+    }
+    return k;
+}
+
+// Writes the gathered lines of the displays without groups in one call,
+// then those of each staggered display group after group, its own
+// 'group_delay_ns' before each of its groups. Displays take turns, so no
+// two groups of the panel switch at the same instant.
+// Groups after a failed write are still written.
+static int display7_gpio_set_staggered(struct display7_panel_st *panel, unsigned int n,
+        bool cansleep)
+{
+    unsigned int d, g, k;
+    bool written;
+    int result = 0;
+
+    k = display7_gather_group(panel, n, DESC_UNGROUPED, 0);
+    if (k)
+    {
+        result = display7_gpio_set_array(k, panel->group_descs, panel->group_values, cansleep);
+    }
+    written = k != 0;
+
+    for (d = 0; d < panel->ndisplays; d++)
+    {
+        struct display7_data_st *disp = &panel->displays[d];
+
+        if (!disp->staggered)
+        {
+            continue;
+        }
+        for (g = 0; g < disp->ngroups; g++)
+        {
+            int group_result;
+
+            k = display7_gather_group(panel, n, d, g);
+            if (!k)
+            {
+                continue;
+            }
+
+            if (written)
+            {
+                ndelay(disp->group_delay_ns);
+            }
+            group_result = display7_gpio_set_array(k, panel->group_descs, panel->group_values,
+                                                   cansleep);
+            if (group_result && !result)
+            {
+                result = group_result;
+            }
+            written = true;
+        }
+    }
+
+    return result;
+}
+
+// Writes the gathered lines in one gpiolib call (one per commit group
+// with 'commit-groups'), traced
+static int display7_gpio_set(struct display7_panel_st *panel, unsigned int n, bool cansleep)
+{
+    int result;
+
+    trace_display7_gpio_set_start(n);
+    if (panel->staggered)
+    {
+        result = display7_gpio_set_staggered(panel, n, cansleep);
+    }
+    else
+    {
+        result = display7_gpio_set_array(n, panel->descs, panel->values, cansleep);
+    }
+    trace_display7_gpio_set_end(n, result);
+
+    if (result)
+    {
+        dev_err(panel->dev, "Error setting a value in GPIOS: %d", result);
+    }
+    return result;
+}
+
+// Accounts a GPIO write of the displays in 'written': their store-to-GPIO
+// latency on success, a failure (and a cache invalidation) otherwise.
+// Called with the panel lock held.
+static void display7_account_write(struct display7_panel_st *panel,
+        const unsigned long *written, int result)
+{
+    ktime_t now = ktime_get();
+    unsigned int i;
+
+    for_each_set_bit(i, written, panel->ndisplays)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+        s64 latency = ktime_to_ns(ktime_sub(now, disp->requested));
+
+        if (result)
+        {
+            disp->latched_valid = false;
+            display7_stat_inc(disp, STAT_GPIO_ERRORS);
+        }
+        else
+        {
+            panel->latency_hist[min_t(unsigned int, latency > 0 ? ilog2(latency) : 0,
+                                      LATENCY_BUCKETS - 1)]++;
+        }
+        disp->requested = 0;
+    }
+}
+
+// Hands the commit of a display over to the commit work.
+// Called with the panel lock held.
+static void display7_defer(struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    if (disp->dirty)
+    {
+        display7_stat_inc(disp, STAT_COALESCED);
+        return;
+    }
+    disp->dirty = true;
+    queue_work(panel->commit_wq, &panel->commit_work);
+}
+
+// Deferred GPIO commit: gathers the changed lines of the dirty displays
+// for display7_gpio_write(). Called with the panel lock held.
+static unsigned int display7_gpio_prepare(struct display7_panel_st *panel, unsigned long *dirty)
+{
+    unsigned int i, n = 0;
+
+    for_each_set_bit(i, dirty, panel->ndisplays)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+        unsigned int added;
+
+        added = display7_gather_changes(disp, disp->pending, panel->descs, panel->values, n);
+        if (!added)
+        {
+            __clear_bit(i, dirty);
+            disp->requested = 0;
+        }
+        n += added;
+    }
+    return n;
+}
+
+static int display7_gpio_write(struct display7_panel_st *panel, unsigned int n)
+{
+    return display7_gpio_set(panel, n, true);
+}
+
+// Outputs the pending masks of all dirty displays, latest request wins.
+// Runs on the ordered commit workqueue, which is the only writer of the
+// outputs of a deferred panel, so the backend may sleep.
+static void display7_commit_work(struct work_struct *work)
+{
+    struct display7_panel_st *panel = container_of(work, struct display7_panel_st, commit_work);
+    DECLARE_BITMAP(dirty, MAX_DISPLAYS);
+    unsigned long flags;
+    unsigned int i, n;
+    int result;
+
+    bitmap_zero(dirty, MAX_DISPLAYS);
+
+    spin_lock_irqsave(&panel->lock, flags);
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+
+        if (disp->dirty)
+        {
+            disp->dirty = false;
+            __set_bit(i, dirty);
+        }
+    }
+    n = panel->backend->prepare(panel, dirty);
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    if (!n)
+    {
+        return;
+    }
+
+    result = panel->backend->write(panel, n);
+
+    spin_lock_irqsave(&panel->lock, flags);
+    display7_account_write(panel, dirty, result);
+    spin_unlock_irqrestore(&panel->lock, flags);
+}
+
+// Hands the back frame of a multiplexed panel over to the refresh timer
+// and goes on with a copy of it in the spare frame.
+// Called with the panel lock held.
+static void display7_scan_publish(struct display7_panel_st *panel)
+{
+    unsigned int spare;
+
+    if (panel->scan_mode != SCAN_MULTIPLEXED || !panel->scan_dirty)
+    {
+        return;
+    }
+    panel->scan_dirty = false;
+
+    spare = atomic_xchg(&panel->scan_ready, panel->scan_back | SCAN_FRAME_FRESH) & SCAN_FRAME_INDEX;
+    memcpy(panel->scan_frames[spare], panel->scan_frame, MAX_DISPLAYS);
+    panel->scan_back = spare;
+    panel->scan_frame = panel->scan_frames[spare];
+}
+
+// Drives the segment lines of one display with its pending mask.
+// When the refresh timer drives the lines (multiplexing or BAM) the mask
+// is only latched for its next slot, deferred panels leave it to the
+// commit work.
+// Called with the panel lock held.
+static void display7_commit(struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    DECLARE_BITMAP(written, MAX_DISPLAYS);
+    unsigned int n;
+    int result;
+
+    bitmap_zero(written, MAX_DISPLAYS);
+
+    display7_publish(disp);
+
+    if (panel->deferred)
+    {
+        display7_defer(disp);
+        return;
+    }
+
+    if (panel->scan_mode == SCAN_MULTIPLEXED || panel->bam)
+    {
+        if (panel->scan_frame[disp->index] == disp->pending)
+        {
+            display7_stat_inc(disp, STAT_CACHE_HITS);
+            return;
+        }
+        display7_stat_inc(disp, STAT_CACHE_MISSES);
+        panel->scan_frame[disp->index] = disp->pending;
+        panel->scan_dirty = true;
+        if (!panel->scan_batch)
+        {
+            display7_scan_publish(panel);
+        }
+        return;
+    }
+
+    panel->scan_frame[disp->index] = disp->pending;
+    if (disp->fast_chip)
+    {
+        n = display7_fast_commit(disp, disp->pending);
+    }
+    else
+    {
+        n = display7_gather_changes(disp, disp->pending, panel->descs, panel->values, 0);
+    }
+    if (!n)
+    {
+        disp->requested = 0;
+        return;
+    }
+    if (disp->fast_chip)
+    {
+        __set_bit(disp->index, written);
+        display7_account_write(panel, written, 0);
+        return;
+    }
+
+    __set_bit(disp->index, written);
+    result = display7_gpio_set(panel, n, false);
+    display7_account_write(panel, written, result);
+}
+
+// Drives the displays in 'displays' with their pending masks at once.
+// gpiolib groups the lines per chip, so displays sharing a gpiochip
+// are updated with a single register write, and so are fast path
+// displays sharing a bank (see display7_fast_queue()). The other displays are left
+// alone, pending masks included.
+// Called with the panel lock held.
+static void display7_commit_displays(struct display7_panel_st *panel, const unsigned long *displays)
+{
+    DECLARE_BITMAP(written, MAX_DISPLAYS);
+    DECLARE_BITMAP(fast_written, MAX_DISPLAYS);
+    unsigned int i, n = 0, nwrites = 0;
+    int result;
+
+    if (panel->scan_mode == SCAN_MULTIPLEXED || panel->deferred || panel->bam)
+    {
+        // The timer gets every display's new mask at once
+        panel->scan_batch = true;
+        for_each_set_bit(i, displays, panel->ndisplays)
+        {
+            display7_commit(&panel->displays[i]);
+        }
+        panel->scan_batch = false;
+        display7_scan_publish(panel);
+        return;
+    }
+
+    bitmap_zero(written, MAX_DISPLAYS);
+    bitmap_zero(fast_written, MAX_DISPLAYS);
+    for_each_set_bit(i, displays, panel->ndisplays)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+        unsigned int added;
+
+        display7_publish(disp);
+        panel->scan_frame[i] = disp->pending;
+        if (disp->fast_chip)
+        {
+            if (display7_fast_queue(disp, &nwrites))
+            {
+                __set_bit(i, fast_written);
+            }
+            else
+            {
+                disp->requested = 0;
+            }
+            continue;
+        }
+
+        added = display7_gather_changes(disp, disp->pending, panel->descs, panel->values, n);
+        if (added)
+        {
+            __set_bit(i, written);
+        }
+        else
+        {
+            disp->requested = 0;
+        }
+        n += added;
+    }
+    display7_fast_flush(panel, nwrites);
+    display7_account_write(panel, fast_written, 0);
+    if (!n)
+    {
+        return;
+    }
+
+    result = display7_gpio_set(panel, n, false);
+    display7_account_write(panel, written, result);
+}
+
+// Outputs the masks of every display held by DISPLAY7_FRAME_DEFER at once
+// (DISPLAY7_IOC_COMMIT). Called with the panel lock held.
+static void display7_commit_held(struct display7_panel_st *panel)
+{
+    DECLARE_BITMAP(held, MAX_DISPLAYS);
+    unsigned int i;
+
+    bitmap_zero(held, MAX_DISPLAYS);
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        if (panel->displays[i].held)
+        {
+            __set_bit(i, held);
+        }
+    }
+    display7_commit_displays(panel, held);
+}
+
+// Stops the marquee if it runs over display 'index'.
+// Called with the panel lock held; the scroll work notices on its next step.
+static void display7_scroll_stop(struct display7_panel_st *panel, unsigned int index)
+{
+    if (panel->scroll_len && index >= panel->scroll_first)
+    {
+        panel->scroll_len = 0;
+        display7_pm_update(panel);
+    }
+}
+
+// Decodes a character into the pending mask of a display and records it.
+// Outputs it right away unless 'defer' is set (see DISPLAY7_IOC_COMMIT).
+// Shared by the sysfs and the character device write paths.
+static void display7_show_char(struct display7_data_st *disp, char digit, bool defer)
+{
+    struct display7_panel_st *panel = disp->panel;
+    unsigned long flags;
+    u8 segments = display7_decode(disp, &digit);
+
+    spin_lock_irqsave(&panel->lock, flags);
+    display7_scroll_stop(panel, disp->index);
+    disp->pending = segments;
+    disp->digit = digit;
+    if (defer)
+    {
+        disp->held = true;
+    }
+    else
+    {
+        display7_commit(disp);
+    }
+    spin_unlock_irqrestore(&panel->lock, flags);
+}
+
+// Shows a raw segment mask, bypassing character decoding
+static void display7_show_segments(struct display7_data_st *disp, u8 segments)
+{
+    struct display7_panel_st *panel = disp->panel;
+    unsigned long flags;
+
+    spin_lock_irqsave(&panel->lock, flags);
+    display7_scroll_stop(panel, disp->index);
+    disp->pending = segments;
+    disp->digit = 0;
+    display7_commit(disp);
+    spin_unlock_irqrestore(&panel->lock, flags);
+}
+
+// Strings
+// ----------------------------------------------
+// Turns a string (up to a newline) into cells, one per display. A '.'
+// lights the decimal point of the cell before it, or gets its own cell.
+// Returns the number of cells or -EINVAL if they do not fit in 'max'.
+static int display7_render(struct display7_data_st *disp, const char *buf, size_t size,
+        struct display7_cell_st *cells, unsigned int max)
+{
+    unsigned int n = 0;
+    size_t i;
+
+    for (i = 0; i < size && buf[i] && buf[i] != '\n'; i++)
+    {
+        if (buf[i] == '.' && n && !(cells[n - 1].segments & SEGMENT_DP))
+        {
+            cells[n - 1].segments |= SEGMENT_DP;
+            continue;
+        }
+
+        if (n == max)
+        {
+            return -EINVAL;
+        }
+
+        cells[n].digit = buf[i];
+        if (buf[i] == '.')
+        {
+            cells[n].segments = SEGMENT_DP;
+        }
+        else
+        {
+            cells[n].segments = display7_decode(disp, &cells[n].digit);
+        }
+        n++;
+    }
+
+    return n;
+}
+
+// Shows the current window of the marquee and commits its displays.
+// Called with the panel lock held.
+static void display7_scroll_show(struct display7_panel_st *panel)
+{
+    unsigned int period = panel->scroll_len + 1;    // Cells plus the gap
+    unsigned int i, pos = panel->scroll_pos;
+    DECLARE_BITMAP(shown, MAX_DISPLAYS);
+
+    for (i = panel->scroll_first; i < panel->ndisplays; i++)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+
+        disp->writer = panel->scroll_writer;
+        if (pos < panel->scroll_len)
+        {
+            disp->digit = panel->scroll_cells[pos].digit;
+            disp->pending = panel->scroll_cells[pos].segments;
+        }
+        else
+        {
+            disp->digit = ' ';
+            disp->pending = 0;
+        }
+        pos = (pos + 1) % period;
+    }
+
+    bitmap_zero(shown, MAX_DISPLAYS);
+    bitmap_set(shown, panel->scroll_first, panel->ndisplays - panel->scroll_first);
+    display7_commit_displays(panel, shown);
+}
+
+static void display7_scroll_work(struct work_struct *work)
+{
+    struct display7_panel_st *panel = container_of(work, struct display7_panel_st,
+                                                   scroll_work.work);
+    unsigned long flags;
+    bool running;
+
+    spin_lock_irqsave(&panel->lock, flags);
+    running = panel->scroll_len != 0;
+    if (running)
+    {
+        panel->scroll_pos = (panel->scroll_pos + 1) % (panel->scroll_len + 1);
+        display7_scroll_show(panel);
+    }
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    if (running)
+    {
+        schedule_delayed_work(&panel->scroll_work,
+                              msecs_to_jiffies(READ_ONCE(panel->scroll_ms)));
+    }
+}
+
+// Shows a string from display 'disp' on, scrolling it when it is longer
+// than the displays left on the panel. Every display it covers, scroll
+// steps included, is credited to 'writer'. An empty string is -EINVAL.
+static int display7_show_text(struct display7_data_st *disp, const char *buf, size_t size,
+        pid_t writer)
+{
+    struct display7_panel_st *panel = disp->panel;
+    struct display7_cell_st cells[MAX_TEXT_CELLS];
+    unsigned int i, width = panel->ndisplays - disp->index;
+    DECLARE_BITMAP(written, MAX_DISPLAYS);
+    unsigned long flags;
+    int n;
+
+    n = display7_render(disp, buf, size, cells, ARRAY_SIZE(cells));
+    if (n <= 0)
+    {
+        return n ? n : -EINVAL;
+    }
+
+    spin_lock_irqsave(&panel->lock, flags);
+    disp->requested = ktime_get();
+    display7_scroll_stop(panel, disp->index + min_t(unsigned int, n, width) - 1);
+
+    if (n <= width)
+    {
+        // Only the displays the string covers are committed
+        bitmap_zero(written, MAX_DISPLAYS);
+        for (i = 0; i < n; i++)
+        {
+            panel->displays[disp->index + i].writer = writer;
+            panel->displays[disp->index + i].digit = cells[i].digit;
+            panel->displays[disp->index + i].pending = cells[i].segments;
+            __set_bit(disp->index + i, written);
+        }
+        display7_commit_displays(panel, written);
+        spin_unlock_irqrestore(&panel->lock, flags);
+        return 0;
+    }
+
+    memcpy(panel->scroll_cells, cells, n * sizeof(cells[0]));
+    panel->scroll_len = n;
+    panel->scroll_first = disp->index;
+    panel->scroll_pos = 0;
+    panel->scroll_writer = writer;
+    display7_pm_update(panel);
+    display7_scroll_show(panel);
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    mod_delayed_work(system_wq, &panel->scroll_work,
+                     msecs_to_jiffies(READ_ONCE(panel->scroll_ms)));
+    return 0;
+}
+
+static ssize_t scroll_ms_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(disp->panel->scroll_ms));
+}
+
+// Applies from the next scroll step on
+static ssize_t scroll_ms_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    unsigned int ms;
+    int result;
+
+    result = kstrtouint(buf, 0, &ms);
+    if (result)
+    {
+        return result;
+    }
+    if (ms < MIN_SCROLL_MS || ms > MAX_SCROLL_MS)
+    {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(disp->panel->scroll_ms, ms);
+    return size;
+}
+
+static DEVICE_ATTR_RW(scroll_ms);
+// ----------------------------------------------
+
+// User space interface for "read" callbacks to special file.
+// One consistent line from the lock-free snapshot: character, committed
+// segment mask and commit sequence number. Characters without a visible
+// form (blank, 0 for raw masks) are written as \x<hex>.
+static ssize_t digit_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    struct display7_state_st state;
+
+    display7_read_state(disp, &state);
+    if (isgraph(state.digit))
+    {
+        return sysfs_emit(buf, "%c 0x%02x %u\n", state.digit, state.segments, state.seq);
+    }
+    return sysfs_emit(buf, "\\x%02x 0x%02x %u\n", (u8) state.digit, state.segments, state.seq);
+}
+
+// User space interface for "write" callbacks to special file
+static ssize_t digit_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    int result;
+
+    trace_display7_store(disp->index, buf, size);
+
+    result = display7_pm_get(disp->panel);
+    if (result)
+    {
+        return result;
+    }
+    result = display7_show_text(disp, buf, size, display7_current_writer());
+    display7_pm_put(disp->panel);
+
+    if (result)
+    {
+        return result;
+    }
+    display7_stat_add(disp, STAT_WRITES, 1);
+    return size;
+}
+
+// Delcares 'dev_attr_digit' of type 'struct device_attribute'.
+// Fills the store/show callbacks with 'digit_store()', 'digit_show()'.
+static DEVICE_ATTR_RW(digit);
+
+
+static ssize_t segments_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    struct display7_state_st state;
+
+    display7_read_state(disp, &state);
+    return sysfs_emit(buf, "0x%02x\n", state.segments);
+}
+
+static ssize_t segments_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    u8 segments;
+    int result;
+
+    result = kstrtou8(buf, 0, &segments);
+    if (result)
+    {
+        return result;
+    }
+
+    result = display7_pm_get(disp->panel);
+    if (result)
+    {
+        return result;
+    }
+    display7_account_request(disp, 1);
+    WRITE_ONCE(disp->requested, ktime_get());
+    display7_show_segments(disp, segments);
+    display7_pm_put(disp->panel);
+    return size;
+}
+
+static DEVICE_ATTR_RW(segments);
+
+// Binary glyph table, one segment mask per ASCII character.
+// Shared by all displays of the panel.
+static ssize_t glyphs_read(struct file *file, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    struct display7_data_st *disp = dev_get_drvdata(kobj_to_dev(kobj));
+    struct display7_panel_st *panel = disp->panel;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        buf[i] = READ_ONCE(panel->glyphs[off + i]) & 0xFF;
+    }
+    return count;
+}
+
+static ssize_t glyphs_write(struct file *file, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    struct display7_data_st *disp = dev_get_drvdata(kobj_to_dev(kobj));
+    struct display7_panel_st *panel = disp->panel;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        WRITE_ONCE(panel->glyphs[off + i], (u8) buf[i]);
+    }
+    return count;
+}
+
+static BIN_ATTR_RW(glyphs, NGLYPHS);
+
+// Refresh engine: multiplexing and brightness
+// ----------------------------------------------
+// Scan slot of one display for a full panel refresh rate. Static panels
+// refresh all displays at once, so their slot is the whole period.
+static ktime_t display7_scan_slot(struct display7_panel_st *panel, unsigned int refresh_hz)
+{
+    unsigned int nslots = panel->scan_mode == SCAN_MULTIPLEXED ? panel->ndisplays : 1;
+
+    return ns_to_ktime(div_u64(NSEC_PER_SEC, refresh_hz * nslots));
+}
+
+// A refresh rate is usable if its shortest BAM slice is not too short
+static bool display7_refresh_valid(struct display7_panel_st *panel, unsigned int refresh_hz)
+{
+    return refresh_hz && refresh_hz <= MAX_REFRESH_HZ &&
+           ktime_to_ns(display7_scan_slot(panel, refresh_hz)) >= MIN_BAM_UNIT_NS * BAM_UNITS;
+}
+
+// Sets the full refresh rate and the governor floor. Called with the
+// panel lock held (or before the timer runs).
+static void display7_set_refresh(struct display7_panel_st *panel, unsigned int min_hz,
+        unsigned int refresh_hz)
+{
+    panel->refresh_hz_min = min_hz;
+    panel->refresh_hz = refresh_hz;
+    panel->scan_slot = display7_scan_slot(panel, refresh_hz);
+    panel->bam_unit = ns_to_ktime(div_u64(ktime_to_ns(panel->scan_slot), BAM_UNITS));
+}
+
+static void display7_scan_stats_reset(struct display7_scan_stats_st *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->jitter_min_ns = S64_MAX;
+}
+
+// Splits brightness levels into BAM bit planes: segment 's' is lit during
+// plane 'b' if bit 'b' of its level is set, and plane 'b' lasts 2^b slices.
+// Returns true if some level is below the maximum, i.e. BAM is needed.
+static bool display7_compute_planes(unsigned int display_level, const u8 *segment_levels,
+        u8 *plane_mask)
+{
+    unsigned int b, s;
+    bool bam = false;
+
+    memset(plane_mask, 0, BAM_PLANES);
+    for (s = 0; s < MAX_SEGMENTS; s++)
+    {
+        unsigned int level = DIV_ROUND_CLOSEST(display_level * segment_levels[s], MAX_BRIGHTNESS);
+
+        if (level != MAX_BRIGHTNESS)
+        {
+            bam = true;
+        }
+        for (b = 0; b < BAM_PLANES; b++)
+        {
+            if (level & BIT(b))
+            {
+                plane_mask[b] |= BIT(s);
+            }
+        }
+    }
+
+    return bam;
+}
+
+// Outputs the current plane of every display of a static panel
+static void display7_scan_static(struct display7_panel_st *panel)
+{
+    unsigned int i, s, bit = 0;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+        unsigned long lit = panel->scan_frame[i] & disp->plane_mask[panel->scan_plane];
+
+        lit = display7_wire(disp, lit);
+        if (disp->fast_chip)
+        {
+            lit &= disp->line_mask;
+            disp->fast_chip->set_multiple(disp->fast_chip, &disp->fast_mask, &disp->fast_bits[lit]);
+            continue;
+        }
+        for (s = 0; s < disp->nsegments; s++, bit++)
+        {
+            __assign_bit(bit, panel->line_values, lit & BIT(s));
+        }
+    }
+
+    if (panel->nlines)
+    {
+        gpiod_set_array_value(panel->nlines, panel->lines, NULL, panel->line_values);
+    }
+}
+
+// Puts the committed masks back on a static panel once BAM is off
+static void display7_scan_static_restore(struct display7_panel_st *panel)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+
+        disp->latched_valid = false;
+        if (disp->fast_chip)
+        {
+            display7_fast_commit(disp, panel->scan_frame[i]);
+            continue;
+        }
+        n += display7_gather_changes(disp, panel->scan_frame[i], panel->descs, panel->values, n);
+    }
+    if (n)
+    {
+        gpiod_set_array_value(n, panel->descs, NULL, panel->values);
+    }
+}
+
+// Start of a scan cycle: takes the frame last handed over, if any, and
+// wakes up DISPLAY7_IOC_WAIT_VSYNC. Returns true on a new frame.
+static bool display7_scan_swap(struct display7_panel_st *panel)
+{
+    bool fresh = atomic_read(&panel->scan_ready) & SCAN_FRAME_FRESH;
+
+    if (fresh)
+    {
+        panel->scan_front = atomic_xchg(&panel->scan_ready, panel->scan_front) & SCAN_FRAME_INDEX;
+    }
+
+    WRITE_ONCE(panel->scan_cycles, panel->scan_cycles + 1);
+    if (wq_has_sleeper(&panel->scan_wait))
+    {
+        wake_up(&panel->scan_wait);
+    }
+    return fresh;
+}
+
+// Picks the rate of the cycle starting: the full rate while frames keep
+// changing, the floor once they have been stable for GOVERNOR_HOLD_MS,
+// so the timer interrupt load follows how much the content changes
+static void display7_scan_govern(struct display7_panel_st *panel, bool changed,
+        unsigned int min_hz, unsigned int max_hz)
+{
+    ktime_t now = ktime_get();
+    unsigned int hz;
+
+    if (changed)
+    {
+        panel->gov_changed = now;
+    }
+    hz = ktime_ms_delta(now, panel->gov_changed) < GOVERNOR_HOLD_MS ? max_hz : min_hz;
+
+    if (hz != panel->gov_hz)
+    {
+        WRITE_ONCE(panel->gov_hz, hz);
+        panel->gov_slot = display7_scan_slot(panel, hz);
+        panel->gov_unit = ns_to_ktime(div_u64(ktime_to_ns(panel->gov_slot), BAM_UNITS));
+    }
+}
+
+// Outputs the current plane of the selected display of a multiplexed
+// panel, without the panel lock. On a new slot, blanks the current
+// display first and selects the next one once its segments are set.
+// Returns the time to the next tick.
+static ktime_t display7_scan_mux(struct display7_panel_st *panel)
+{
+    struct gpio_descs *descs = panel->scan_segments;
+    struct display7_data_st *disp;
+    unsigned long segments;
+    unsigned int seq, min_hz, max_hz;
+    bool bam, next_slot;
+
+    do
+    {
+        seq = read_seqcount_begin(&panel->scan_seq);
+        bam = panel->bam;
+        min_hz = panel->refresh_hz_min;
+        max_hz = panel->refresh_hz;
+    } while (read_seqcount_retry(&panel->scan_seq, seq));
+
+    // Frames are only swapped in at the start of a cycle. One handed over
+    // while the rate is down brings it back up from this slot on, rather
+    // than waiting out a whole cycle at the floor.
+    if (panel->gov_hz != max_hz && (atomic_read(&panel->scan_ready) & SCAN_FRAME_FRESH))
+    {
+        display7_scan_govern(panel, true, min_hz, max_hz);
+    }
+
+    // Without BAM every slot is a single plane
+    next_slot = !bam || ++panel->scan_plane == BAM_PLANES;
+    if (next_slot)
+    {
+        panel->scan_plane = 0;
+        gpiod_set_value(panel->displays[panel->scan_pos].select, 0);
+        panel->scan_pos = (panel->scan_pos + 1) % panel->ndisplays;
+        if (!panel->scan_pos)
+        {
+            display7_scan_govern(panel, display7_scan_swap(panel), min_hz, max_hz);
+        }
+    }
+    disp = &panel->displays[panel->scan_pos];
+
+    segments = panel->scan_frames[panel->scan_front][panel->scan_pos];
+    if (bam)
+    {
+        segments &= READ_ONCE(disp->plane_mask[panel->scan_plane]);
+    }
+    segments = display7_wire(disp, segments);
+    gpiod_set_array_value(descs->ndescs, descs->desc, descs->info, &segments);
+
+    if (next_slot)
+    {
+        gpiod_set_value(disp->select, 1);
+    }
+
+    return bam ? ns_to_ktime(ktime_to_ns(panel->gov_unit) << panel->scan_plane)
+               : panel->gov_slot;
+}
+
+// Runs in hard interrupt context, so the lines must not sleep (checked
+// at probe). Multiplexed panels scan forever, static panels only run the
+// timer while BAM is needed, under the panel lock.
+static enum hrtimer_restart display7_scan_tick(struct hrtimer *timer)
+{
+    struct display7_panel_st *panel = container_of(timer, struct display7_panel_st, scan_timer);
+    struct display7_scan_stats_st *stats = &panel->scan_stats;
+    s64 jitter = ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer)));
+    enum hrtimer_restart restart = HRTIMER_RESTART;
+    ktime_t interval;
+    u64 forwarded;
+
+    if (panel->scan_mode == SCAN_MULTIPLEXED)
+    {
+        interval = display7_scan_mux(panel);
+    }
+    else
+    {
+        spin_lock(&panel->lock);
+
+        if (!panel->bam || ++panel->scan_plane == BAM_PLANES)
+        {
+            panel->scan_plane = 0;
+        }
+        if (panel->bam)
+        {
+            display7_scan_static(panel);
+        }
+        else
+        {
+            display7_scan_static_restore(panel);
+            restart = HRTIMER_NORESTART;
+        }
+        interval = panel->bam ? ns_to_ktime(ktime_to_ns(panel->bam_unit) << panel->scan_plane)
+                              : panel->scan_slot;
+
+        spin_unlock(&panel->lock);
+    }
+
+    forwarded = hrtimer_forward_now(timer, interval);
+
+    write_seqcount_begin(&panel->scan_stats_seq);
+    if (READ_ONCE(panel->scan_stats_reset))
+    {
+        WRITE_ONCE(panel->scan_stats_reset, false);
+        display7_scan_stats_reset(stats);
+    }
+    stats->ticks++;
+    stats->overruns += forwarded - 1;
+    stats->jitter_sum_ns += jitter;
+    stats->jitter_min_ns = min(stats->jitter_min_ns, jitter);
+    stats->jitter_max_ns = max(stats->jitter_max_ns, jitter);
+    write_seqcount_end(&panel->scan_stats_seq);
+
+    return restart;
+}
+
+static void display7_scan_start(struct display7_panel_st *panel)
+{
+    // The first tick selects display 0, plane 0
+    panel->scan_pos = panel->ndisplays - 1;
+    panel->scan_plane = BAM_PLANES - 1;
+    panel->gov_hz = 0;                  // Set up again on the first cycle
+    panel->gov_changed = ktime_get();
+    WRITE_ONCE(panel->scan_stats_reset, true);
+    hrtimer_start(&panel->scan_timer, panel->scan_slot, HRTIMER_MODE_REL);
+}
+
+// Sets the hardware PWM duty cycle of a display from its brightness
+static int display7_apply_pwm(struct display7_data_st *disp)
+{
+    struct pwm_state state;
+
+    pwm_init_state(disp->pwm, &state);
+    pwm_set_relative_duty_cycle(&state, disp->brightness, MAX_BRIGHTNESS);
+    state.enabled = true;
+    return pwm_apply_state(disp->pwm, &state);
+}
+
+// Applies new brightness levels to a display. The display level goes to
+// the PWM when the display has one, or to the backend when it dims by
+// itself, everything else to software BAM, which needs lines the refresh
+// timer can drive. Panels with staggered displays can't use BAM: its
+// planes switch every line at once, the inrush 'commit-groups' avoid.
+// 'segment_levels' may be NULL to keep the current ones.
+static int display7_set_brightness(struct display7_data_st *disp, unsigned int brightness,
+        const u8 *segment_levels)
+{
+    struct display7_panel_st *panel = disp->panel;
+    u8 plane_mask[BAM_PLANES];
+    u8 levels[MAX_SEGMENTS];
+    unsigned long flags;
+    bool hw_dim = disp->pwm || panel->backend->set_brightness;
+    bool bam, disp_bam, start = false;
+    unsigned int i;
+    int result = 0;
+
+    memcpy(levels, segment_levels ? segment_levels : disp->segment_brightness, sizeof(levels));
+
+    // The PWM and the refresh timer are only touched while resumed
+    result = display7_pm_get(panel);
+    if (result)
+    {
+        return result;
+    }
+    mutex_lock(&panel->config_lock);
+    spin_lock_irqsave(&panel->lock, flags);
+
+    disp_bam = display7_compute_planes(hw_dim ? MAX_BRIGHTNESS : brightness, levels, plane_mask);
+    bam = disp_bam;
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        if (i != disp->index && panel->displays[i].bam)
+        {
+            bam = true;
+        }
+    }
+
+    if (bam && (panel->deferred || panel->staggered))
+    {
+        spin_unlock_irqrestore(&panel->lock, flags);
+        result = -EOPNOTSUPP;
+        goto out;
+    }
+
+    disp->brightness = brightness;
+    memcpy(disp->segment_brightness, levels, sizeof(levels));
+    disp->bam = disp_bam;
+
+    // A static panel starts its timer for BAM, which stops by itself
+    // (restoring the plain levels) once BAM is no longer needed
+    start = bam && !panel->bam && panel->scan_mode == SCAN_STATIC;
+    write_seqcount_begin(&panel->scan_seq);
+    memcpy(disp->plane_mask, plane_mask, sizeof(plane_mask));
+    panel->bam = bam;
+    write_seqcount_end(&panel->scan_seq);
+
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    if (disp->pwm)
+    {
+        result = display7_apply_pwm(disp);
+    }
+    else if (panel->backend->set_brightness)
+    {
+        result = panel->backend->set_brightness(disp);
+    }
+    if (start)
+    {
+        hrtimer_cancel(&panel->scan_timer);
+        display7_scan_start(panel);
+    }
+
+out:
+    mutex_unlock(&panel->config_lock);
+    display7_pm_put(panel);
+    return result;
+}
+
+static ssize_t brightness_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(disp->brightness));
+}
+
+static ssize_t brightness_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    unsigned int brightness;
+    int result;
+
+    result = kstrtouint(buf, 0, &brightness);
+    if (result)
+    {
+        return result;
+    }
+    if (brightness > MAX_BRIGHTNESS)
+    {
+        return -EINVAL;
+    }
+
+    result = display7_set_brightness(disp, brightness, NULL);
+    return result ? result : size;
+}
+
+// Levels of segments a..g and dp
+static ssize_t segment_brightness_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    u8 *l = disp->segment_brightness;
+
+    return sysfs_emit(buf, "%u %u %u %u %u %u %u %u\n",
+                      l[0], l[1], l[2], l[3], l[4], l[5], l[6], l[7]);
+}
+
+// Takes either one level for all segments or eight levels (a..g, dp)
+static ssize_t segment_brightness_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    unsigned int l[MAX_SEGMENTS];
+    u8 levels[MAX_SEGMENTS];
+    int i, count, result;
+
+    count = sscanf(buf, "%u %u %u %u %u %u %u %u",
+                   &l[0], &l[1], &l[2], &l[3], &l[4], &l[5], &l[6], &l[7]);
+    if (count != 1 && count != MAX_SEGMENTS)
+    {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < MAX_SEGMENTS; i++)
+    {
+        unsigned int level = l[count == 1 ? 0 : i];
+
+        if (level > MAX_BRIGHTNESS)
+        {
+            return -EINVAL;
+        }
+        levels[i] = level;
+    }
+
+    result = display7_set_brightness(disp, READ_ONCE(disp->brightness), levels);
+    return result ? result : size;
+}
+
+// The rate in use, which the governor of a multiplexed panel moves
+// between 'refresh_hz_min' and 'refresh_hz_max'
+static ssize_t refresh_hz_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    struct display7_panel_st *panel = disp->panel;
+    unsigned int hz = 0;
+
+    if (panel->scan_mode == SCAN_MULTIPLEXED)
+    {
+        hz = READ_ONCE(panel->gov_hz);
+    }
+    return sysfs_emit(buf, "%u\n", hz ? hz : READ_ONCE(panel->refresh_hz));
+}
+
+// Applies new governor bounds from the next scan cycle on (the next
+// slot on static panels) and restarts the statistics
+static int display7_store_refresh(struct display7_panel_st *panel, unsigned int min_hz,
+        unsigned int max_hz)
+{
+    unsigned long flags;
+
+    if (!display7_refresh_valid(panel, max_hz) || !min_hz || min_hz > max_hz)
+    {
+        return -EINVAL;
+    }
+
+    spin_lock_irqsave(&panel->lock, flags);
+    write_seqcount_begin(&panel->scan_seq);
+    display7_set_refresh(panel, min_hz, max_hz);
+    write_seqcount_end(&panel->scan_seq);
+    WRITE_ONCE(panel->scan_stats_reset, true);
+    spin_unlock_irqrestore(&panel->lock, flags);
+    return 0;
+}
+
+// Sets a fixed rate (both bounds)
+static ssize_t refresh_hz_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    unsigned int hz;
+    int result;
+
+    result = kstrtouint(buf, 0, &hz);
+    if (result)
+    {
+        return result;
+    }
+
+    result = display7_store_refresh(disp->panel, hz, hz);
+    return result ? result : size;
+}
+
+static ssize_t refresh_hz_min_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(disp->panel->refresh_hz_min));
+}
+
+// Rate of stable content, up to 'refresh_hz_max'
+static ssize_t refresh_hz_min_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    unsigned int hz;
+    int result;
+
+    result = kstrtouint(buf, 0, &hz);
+    if (result)
+    {
+        return result;
+    }
+
+    result = display7_store_refresh(disp->panel, hz, READ_ONCE(disp->panel->refresh_hz));
+    return result ? result : size;
+}
+
+static ssize_t refresh_hz_max_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(disp->panel->refresh_hz));
+}
+
+// Rate while frames change. The floor follows it down if needed.
+static ssize_t refresh_hz_max_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    unsigned int hz;
+    int result;
+
+    result = kstrtouint(buf, 0, &hz);
+    if (result)
+    {
+        return result;
+    }
+
+    result = display7_store_refresh(disp->panel,
+                                    min(READ_ONCE(disp->panel->refresh_hz_min), hz), hz);
+    return result ? result : size;
+}
+
+
+static ssize_t scan_mode_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", disp->panel->scan_mode == SCAN_MULTIPLEXED ?
+                                   "multiplexed" : "static");
+}
+
+static DEVICE_ATTR_RW(brightness);
+static DEVICE_ATTR_RW(segment_brightness);
+static DEVICE_ATTR_RW(refresh_hz);
+static DEVICE_ATTR_RW(refresh_hz_min);
+static DEVICE_ATTR_RW(refresh_hz_max);
+static DEVICE_ATTR_RO(scan_mode);
+
+// Reads the optional 'segment-order' of a node listing 'nlines' segment
+// lines: entry <i> is the segment (0 = a ... 6 = g, 7 = dp) wired to line
+// <i>. Builds the table turning every segment mask into line levels, so
+// commits stay a single lookup. Leaves *remap NULL without the property.
+static int display7_parse_order(struct display7_panel_st *panel, struct device_node *np,
+        unsigned int nlines, const u8 **remap)
+{
+    u32 order[MAX_SEGMENTS];
+    unsigned long seen = 0;
+    unsigned int i, m;
+    u8 *table;
+    int count;
+
+    *remap = NULL;
+    count = of_property_count_u32_elems(np, "segment-order");
+    if (count == -EINVAL)
+    {
+        return 0;
+    }
+    if (count != nlines ||
+        of_property_read_u32_array(np, "segment-order", order, count))
+    {
+        dev_err(panel->dev, "%pOF: segment-order needs one entry per segment line", np);
+        return -EINVAL;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (order[i] >= MAX_SEGMENTS || __test_and_set_bit(order[i], &seen))
+        {
+            dev_err(panel->dev, "%pOF: invalid segment-order", np);
+            return -EINVAL;
+        }
+    }
+
+    table = devm_kzalloc(panel->dev, BIT(MAX_SEGMENTS), GFP_KERNEL);
+    if (!table)
+    {
+        return -ENOMEM;
+    }
+    for (m = 0; m < BIT(MAX_SEGMENTS); m++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            if (m & BIT(order[i]))
+            {
+                table[m] |= BIT(i);
+            }
+        }
+    }
+
+    *remap = table;
+    return 0;
+}
+
+// Reads the scan configuration common to all displays from the parent node
+static int display7_parse_scan(struct device_node *np, struct display7_panel_st *panel)
+{
+    const char *mode = NULL;
+    unsigned int i;
+    u32 hz = DEFAULT_REFRESH_HZ;
+    u32 min_hz;
+
+    hrtimer_init(&panel->scan_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    panel->scan_timer.function = display7_scan_tick;
+
+    panel->scan_mode = SCAN_STATIC;
+    if (!of_property_read_string(np, "scan-mode", &mode) && strcmp(mode, "static"))
+    {
+        if (strcmp(mode, "multiplexed"))
+        {
+            dev_err(panel->dev, "Unknown scan-mode \"%s\"", mode);
+            return -EINVAL;
+        }
+        if (!panel->backend->multiplexed)
+        {
+            dev_err(panel->dev, "No multiplexed scanning on %s panels", panel->backend->name);
+            return -EINVAL;
+        }
+        panel->scan_mode = SCAN_MULTIPLEXED;
+    }
+
+    of_property_read_u32(np, "refresh-rate-hz", &hz);
+    if (!display7_refresh_valid(panel, hz))
+    {
+        dev_err(panel->dev, "Invalid refresh-rate-hz %u", hz);
+        return -EINVAL;
+    }
+    min_hz = hz;
+    of_property_read_u32(np, "refresh-rate-min-hz", &min_hz);
+    if (!min_hz || min_hz > hz)
+    {
+        dev_err(panel->dev, "Invalid refresh-rate-min-hz %u", min_hz);
+        return -EINVAL;
+    }
+    display7_set_refresh(panel, min_hz, hz);
+
+    if (panel->scan_mode == SCAN_STATIC)
+    {
+        return 0;
+    }
+
+    panel->scan_segments = devm_gpiod_get_array(panel->dev, "segment", GPIOD_OUT_LOW);
+    if (IS_ERR(panel->scan_segments))
+    {
+        dev_err(panel->dev, "Error getting shared segment GPIOS: %ld",
+                PTR_ERR(panel->scan_segments));
+        return PTR_ERR(panel->scan_segments);
+    }
+
+    // The scan timer drives the lines from hard interrupt context
+    for (i = 0; i < panel->scan_segments->ndescs; i++)
+    {
+        if (gpiod_cansleep(panel->scan_segments->desc[i]))
+        {
+            dev_err(panel->dev, "Multiplexed scanning needs non-sleeping GPIOS");
+            return -EINVAL;
+        }
+    }
+
+    return display7_parse_order(panel, np, panel->scan_segments->ndescs, &panel->scan_remap);
+}
+// ----------------------------------------------
+
+// Playback FIFO
+// ----------------------------------------------
+// Shows the next queued entry and schedules the one after it.
+// Expiry is advanced from the previous one, so entry durations don't add
+// up the interrupt latency.
+static enum hrtimer_restart display7_fifo_tick(struct hrtimer *timer)
+{
+    struct display7_data_st *disp = container_of(timer, struct display7_data_st, fifo_timer);
+    struct display7_panel_st *panel = disp->panel;
+    struct display7_fifo_entry entry;
+
+    spin_lock(&panel->lock);
+
+    if (!kfifo_get(&disp->fifo, &entry))
+    {
+        if (!disp->fifo_end)
+        {
+            disp->fifo_underruns++;
+        }
+        disp->fifo_running = false;
+        panel->fifos_running--;
+        display7_pm_update(panel);
+        spin_unlock(&panel->lock);
+        return HRTIMER_NORESTART;
+    }
+    if (disp->fifo_loop)
+    {
+        kfifo_put(&disp->fifo, entry);
+    }
+
+    display7_scroll_stop(panel, disp->index);
+    disp->pending = entry.segments;
+    disp->digit = 0;
+    display7_commit(disp);
+
+    hrtimer_set_expires(timer, ktime_add_us(hrtimer_get_expires(timer), entry.duration_us));
+
+    spin_unlock(&panel->lock);
+
+    return HRTIMER_RESTART;
+}
+
+// Queues entries from user space and starts playback if it was idle.
+// Returns how many entries were queued, short of the request when the
+// FIFO filled up.
+static int display7_fifo_push(struct display7_data_st *disp,
+        const struct display7_fifo_push __user *upush)
+{
+    struct display7_panel_st *panel = disp->panel;
+    struct display7_fifo_entry entries[WRITE_CHUNK_FRAMES];
+    const struct display7_fifo_entry __user *uentries;
+    struct display7_fifo_push push;
+    unsigned long flags;
+    unsigned int done = 0;
+    int result = 0;
+
+    if (copy_from_user(&push, upush, sizeof(push)))
+    {
+        return -EFAULT;
+    }
+    if (push.flags & ~DISPLAY7_FIFO_FLAGS)
+    {
+        return -EINVAL;
+    }
+    uentries = u64_to_user_ptr(push.entries);
+
+    mutex_lock(&disp->fifo_lock);
+
+    while (done < push.count)
+    {
+        unsigned int n = min_t(unsigned int, push.count - done, ARRAY_SIZE(entries));
+        unsigned int i, queued;
+
+        if (copy_from_user(entries, uentries + done, n * sizeof(entries[0])))
+        {
+            result = -EFAULT;
+            break;
+        }
+        for (i = 0; i < n; i++)
+        {
+            if (entries[i].reserved[0] || entries[i].reserved[1] || entries[i].reserved[2] ||
+                entries[i].duration_us < FIFO_MIN_DURATION_US)
+            {
+                result = -EINVAL;
+                break;
+            }
+        }
+        n = i;
+
+        spin_lock_irqsave(&panel->lock, flags);
+        queued = kfifo_in(&disp->fifo, entries, n);
+        disp->fifo_loop = push.flags & DISPLAY7_FIFO_LOOP;
+        disp->fifo_end = push.flags & DISPLAY7_FIFO_END;
+        if (queued && !disp->fifo_running)
+        {
+            disp->fifo_running = true;
+            panel->fifos_running++;
+            display7_pm_update(panel);
+            hrtimer_start(&disp->fifo_timer, 0, HRTIMER_MODE_REL);
+        }
+        spin_unlock_irqrestore(&panel->lock, flags);
+
+        display7_account_request(disp, queued);
+        done += queued;
+        if (result || queued < n)
+        {
+            break;
+        }
+    }
+
+    mutex_unlock(&disp->fifo_lock);
+
+    return done ? done : result;
+}
+
+// Stops playback and drops queued entries; the display keeps showing
+// the last entry played
+static void display7_fifo_flush(struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    unsigned long flags;
+
+    mutex_lock(&disp->fifo_lock);
+    hrtimer_cancel(&disp->fifo_timer);
+
+    spin_lock_irqsave(&panel->lock, flags);
+    kfifo_reset(&disp->fifo);
+    if (disp->fifo_running)
+    {
+        disp->fifo_running = false;
+        panel->fifos_running--;
+        display7_pm_update(panel);
+    }
+    disp->fifo_loop = false;
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    mutex_unlock(&disp->fifo_lock);
+}
+
+static ssize_t fifo_depth_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u %u\n", kfifo_len(&disp->fifo), kfifo_size(&disp->fifo));
+}
+
+
+static DEVICE_ATTR_RO(fifo_depth);
+// ----------------------------------------------
+
+// sysfs attribute group
+// ----------------------------------------------
+// Counters of the display and of the refresh engine of its panel, one
+// "name value" pair per line. The per-CPU ones are summed as they are
+// read, so they may be a few events apart from each other under load.
+//  writes       characters and masks requested through any interface
+//  decode_*     characters shown as '8' for lack of a glyph
+//  gpio_errors  failed GPIO writes of the display
+//  cache_*      commits that found the lines already showing their mask,
+//               those that did not, and deferred commits merged
+//  fifo_*       playback FIFO running dry
+//  scan_*       refresh timer ticks, missed slots and jitter (restarted
+//               by writes to the refresh_hz* files)
+static ssize_t stats_show(struct device *dev,
+            struct device_attribute *attr, char *buf)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    struct display7_panel_st *panel = disp->panel;
+    struct display7_scan_stats_st scan;
+    u64 counters[NR_STATS];
+    unsigned int underruns, seq;
+
+    display7_stats_sum(disp, counters);
+    underruns = READ_ONCE(disp->fifo_underruns);
+
+    do
+    {
+        seq = read_seqcount_begin(&panel->scan_stats_seq);
+        scan = panel->scan_stats;
+    } while (read_seqcount_retry(&panel->scan_stats_seq, seq));
+
+    if (!scan.ticks)
+    {
+        scan.jitter_min_ns = 0;
+    }
+
+    return sysfs_emit(buf,
+                      "writes %llu\n"
+                      "decode_fallbacks %llu\n"
+                      "gpio_errors %llu\n"
+                      "cache_hits %llu\n"
+                      "cache_misses %llu\n"
+                      "cache_coalesced %llu\n"
+                      "fifo_underruns %u\n"
+                      "scan_ticks %llu\n"
+                      "scan_overruns %llu\n"
+                      "scan_jitter_min_ns %lld\n"
+                      "scan_jitter_max_ns %lld\n"
+                      "scan_jitter_avg_ns %llu\n",
+                      counters[STAT_WRITES], counters[STAT_DECODE_FALLBACKS],
+                      counters[STAT_GPIO_ERRORS], counters[STAT_CACHE_HITS],
+                      counters[STAT_CACHE_MISSES], counters[STAT_COALESCED], underruns,
+                      scan.ticks, scan.overruns,
+                      scan.jitter_min_ns, scan.jitter_max_ns,
+                      scan.ticks ? div64_u64(scan.jitter_sum_ns, scan.ticks) : 0);
+}
+
+static DEVICE_ATTR_RO(stats);
+
+// Files of every display, created along with its device so they are
+// all there by the time user space hears of it
+static struct attribute *display7_attrs[] = {
+    &dev_attr_digit.attr,
+    &dev_attr_segments.attr,
+    &dev_attr_scroll_ms.attr,
+    &dev_attr_brightness.attr,
+    &dev_attr_segment_brightness.attr,
+    &dev_attr_refresh_hz.attr,
+    &dev_attr_refresh_hz_min.attr,
+    &dev_attr_refresh_hz_max.attr,
+    &dev_attr_scan_mode.attr,
+    &dev_attr_fifo_depth.attr,
+    &dev_attr_stats.attr,
+    NULL,
+};
+
+static struct bin_attribute *display7_bin_attrs[] = {
+    &bin_attr_glyphs,
+    NULL,
+};
+
+static const struct attribute_group display7_group = {
+    .attrs = display7_attrs,
+    .bin_attrs = display7_bin_attrs,
+};
+
+static const struct attribute_group *display7_groups[] = {
+    &display7_group,
+    NULL,
+};
+// ----------------------------------------------
+
+// Character device interface
+// ----------------------------------------------
+// Frees a panel once its last reference is gone, long after unbind if
+// files or mappings were left open
+static void display7_panel_release(struct kref *kref)
+{
+    struct display7_panel_st *panel = container_of(kref, struct display7_panel_st, kref);
+    unsigned int i;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        kfree(panel->displays[i].history);
+        free_percpu(panel->displays[i].stats);
+    }
+    kfree(panel->displays);
+    kfree(panel);
+}
+
+static void display7_panel_put(struct display7_panel_st *panel)
+{
+    kref_put(&panel->kref, display7_panel_release);
+}
+
+// Starts a file operation that uses the bound panel: its lines, timers
+// and works. Fails with -ENODEV once unbound, otherwise unbind waits for
+// display7_op_end().
+static int display7_op_begin(struct display7_panel_st *panel)
+{
+    down_read(&panel->ops_lock);
+    if (READ_ONCE(panel->dead))
+    {
+        up_read(&panel->ops_lock);
+        return -ENODEV;
+    }
+    return 0;
+}
+
+static void display7_op_end(struct display7_panel_st *panel)
+{
+    up_read(&panel->ops_lock);
+}
+
+// Every open file streams the display's history from the next commit on
+static int display7_open(struct inode *inode, struct file *file)
+{
+    struct display7_data_st *disp = container_of(inode->i_cdev, struct display7_data_st, cdev);
+    struct display7_reader_st *reader;
+
+    if (READ_ONCE(disp->panel->dead))
+    {
+        return -ENODEV;
+    }
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader)
+    {
+        return -ENOMEM;
+    }
+    reader->disp = disp;
+    reader->pos = READ_ONCE(disp->history_head);
+    kref_get(&disp->panel->kref);
+
+    file->private_data = reader;
+    return nonseekable_open(inode, file);
+}
+
+static int display7_release(struct inode *inode, struct file *file)
+{
+    struct display7_reader_st *reader = file->private_data;
+
+    display7_panel_put(reader->disp->panel);
+    kfree(reader);
+    return 0;
+}
+
+static bool display7_history_pending(struct display7_reader_st *reader)
+{
+    return READ_ONCE(reader->disp->history_head) != reader->pos;
+}
+
+static struct display7_data_st *display7_file_disp(struct file *file)
+{
+    return ((struct display7_reader_st *) file->private_data)->disp;
+}
+
+// Returns whole 'struct display7_event's, oldest first. Blocks at the tail
+// of the history unless the file is non-blocking. After falling more than
+// HISTORY_LEN commits behind the reader resumes at the oldest one kept.
+static ssize_t display7_read(struct file *file, char __user *ubuf,
+        size_t size, loff_t *ppos)
+{
+    struct display7_reader_st *reader = file->private_data;
+    struct display7_data_st *disp = reader->disp;
+    struct display7_panel_st *panel = disp->panel;
+    struct display7_event events[WRITE_CHUNK_FRAMES];
+    unsigned long flags;
+    unsigned int i, n;
+    int result;
+
+    if (size < sizeof(events[0]))
+    {
+        return -EINVAL;
+    }
+
+    if (!display7_history_pending(reader) && !READ_ONCE(panel->dead))
+    {
+        if (file->f_flags & O_NONBLOCK)
+        {
+            return -EAGAIN;
+        }
+        result = wait_event_interruptible(disp->wait, display7_history_pending(reader) ||
+                                                      READ_ONCE(panel->dead));
+        if (result)
+        {
+            return result;
+        }
+    }
+    if (READ_ONCE(panel->dead))
+    {
+        return -ENODEV;
+    }
+
+    // Records are copied out under the lock, to user space unlocked
+    spin_lock_irqsave(&panel->lock, flags);
+    if (disp->history_head - reader->pos > HISTORY_LEN)
+    {
+        reader->pos = disp->history_head - HISTORY_LEN;
+    }
+    n = min_t(size_t, size / sizeof(events[0]), ARRAY_SIZE(events));
+    n = min(n, disp->history_head - reader->pos);
+    for (i = 0; i < n; i++)
+    {
+        events[i] = disp->history[(reader->pos + i) & (HISTORY_LEN - 1)];
+    }
+    reader->pos += n;
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    if (copy_to_user(ubuf, events, n * sizeof(events[0])))
+    {
+        return -EFAULT;
+    }
+    return n * sizeof(events[0]);
+}
+
+// Always writable, readable while commits are left to read, hung up
+// once unbound
+static __poll_t display7_poll(struct file *file, poll_table *wait)
+{
+    struct display7_reader_st *reader = file->private_data;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &reader->disp->wait, wait);
+    if (READ_ONCE(reader->disp->panel->dead))
+    {
+        return EPOLLERR | EPOLLHUP;
+    }
+    if (display7_history_pending(reader))
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    return mask;
+}
+
+// Holds the current frame for 'dwell_us' microseconds.
+// Returns -EINTR if a signal interrupted the wait, -ENODEV if unbind did.
+static int display7_dwell(struct display7_data_st *disp, u32 dwell_us)
+{
+    long result;
+
+    if (!dwell_us)
+    {
+        return 0;
+    }
+
+    // Long enough to hold up an unbind, which wakes 'disp->wait'
+    if (dwell_us >= DWELL_MSLEEP_US)
+    {
+        result = wait_event_interruptible_timeout(disp->wait, READ_ONCE(disp->panel->dead),
+                                                  msecs_to_jiffies(dwell_us / USEC_PER_MSEC));
+        if (result < 0)
+        {
+            return -EINTR;
+        }
+        return result ? -ENODEV : 0;
+    }
+
+    usleep_range(dwell_us, dwell_us + dwell_us / 8 + 1);
+    return signal_pending(current) ? -EINTR : 0;
+}
+
+// Applies an array of 'struct display7_frame' in order.
+// Returns the number of bytes consumed, which is short of 'size' only if
+// a signal or unbind interrupted a dwell or a later chunk could not be
+// copied. Short dwells don't wake up on unbind, so it is checked before
+// every frame: unbind then waits for one frame at most.
+static ssize_t display7_write_frames(struct display7_data_st *disp,
+        const char __user *ubuf, size_t size)
+{
+    struct display7_frame frames[WRITE_CHUNK_FRAMES];
+    size_t done = 0;
+
+    while (done < size)
+    {
+        size_t chunk = min(size - done, sizeof(frames));
+        size_t i;
+
+        if (copy_from_user(frames, ubuf + done, chunk))
+        {
+            return done ? done : -EFAULT;
+        }
+
+        for (i = 0; i < chunk / sizeof(frames[0]); i++)
+        {
+            if ((frames[i].flags & ~DISPLAY7_FRAME_FLAGS) ||
+                frames[i].reserved[0] || frames[i].reserved[1])
+            {
+                return done ? done : -EINVAL;
+            }
+            if (READ_ONCE(disp->panel->dead))
+            {
+                return done ? done : -ENODEV;
+            }
+
+            display7_account_request(disp, 1);
+            WRITE_ONCE(disp->requested, ktime_get());
+            display7_show_char(disp, frames[i].digit,
+                               frames[i].flags & DISPLAY7_FRAME_DEFER);
+            done += sizeof(frames[i]);
+
+            if (display7_dwell(disp, frames[i].dwell_us))
+            {
+                return done;
+            }
+        }
+    }
+
+    return done;
+}
+
+// The panel stays resumed for the whole write, dwells included
+static ssize_t display7_write(struct file *file, const char __user *ubuf,
+        size_t size, loff_t *ppos)
+{
+    struct display7_data_st *disp = display7_file_disp(file);
+    ssize_t result;
+
+    if (size % sizeof(struct display7_frame))
+    {
+        return -EINVAL;
+    }
+
+    result = display7_op_begin(disp->panel);
+    if (result)
+    {
+        return result;
+    }
+    result = display7_pm_get(disp->panel);
+    if (!result)
+    {
+        result = display7_write_frames(disp, ubuf, size);
+        display7_pm_put(disp->panel);
+    }
+    display7_op_end(disp->panel);
+    return result;
+}
+
+// Shared framebuffer
+// ----------------------------------------------
+// Commits the framebuffer bytes user space changed since the last
+// pick-up, their displays in one go. Writes through sysfs or write() are
+// left alone until their framebuffer byte changes again.
+static void display7_fb_sync(struct display7_panel_st *panel)
+{
+    DECLARE_BITMAP(changed, MAX_DISPLAYS);
+    unsigned long flags;
+    bool dirty = false;
+    unsigned int i;
+
+    bitmap_zero(changed, MAX_DISPLAYS);
+
+    spin_lock_irqsave(&panel->lock, flags);
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+        u8 segments = READ_ONCE(panel->fb[i]);
+
+        if (segments != disp->fb_shadow)
+        {
+            display7_scroll_stop(panel, i);
+            display7_account_request(disp, 1);
+            disp->pending = segments;
+            disp->fb_shadow = segments;
+            disp->digit = 0;
+            __set_bit(i, changed);
+            dirty = true;
+        }
+    }
+
+    if (dirty)
+    {
+        display7_commit_displays(panel, changed);
+    }
+    spin_unlock_irqrestore(&panel->lock, flags);
+}
+
+static void display7_fb_work(struct work_struct *work)
+{
+    struct display7_panel_st *panel = container_of(work, struct display7_panel_st,
+                                                   fb_work.work);
+    unsigned int period_ms = READ_ONCE(fb_refresh_ms);
+
+    display7_fb_sync(panel);
+
+    if (period_ms && atomic_read(&panel->fb_users))
+    {
+        schedule_delayed_work(&panel->fb_work,
+                              msecs_to_jiffies(period_ms));
+    }
+}
+
+// Restarts the tick of a mapped panel, which stops rescheduling itself
+// while 'fb_refresh_ms' is 0. Queued under the lock, so unbind cancels it.
+static int display7_fb_kick(struct device *dev, void *data)
+{
+    struct display7_data_st *disp = dev_get_drvdata(dev);
+    struct display7_panel_st *panel = disp->panel;
+    unsigned long flags;
+
+    // Once per panel
+    if (disp->index)
+    {
+        return 0;
+    }
+
+    spin_lock_irqsave(&panel->lock, flags);
+    if (!panel->dead && atomic_read(&panel->fb_users))
+    {
+        mod_delayed_work(system_wq, &panel->fb_work, 0);
+    }
+    spin_unlock_irqrestore(&panel->lock, flags);
+    return 0;
+}
+
+static int display7_fb_refresh_set(const char *val, const struct kernel_param *kp)
+{
+    int result;
+
+    result = param_set_uint(val, kp);
+    if (result)
+    {
+        return result;
+    }
+
+    // Not registered yet when set at load time
+    if (display7_class)
+    {
+        class_for_each_device(display7_class, NULL, NULL, display7_fb_kick);
+    }
+    return 0;
+}
+
+static const struct kernel_param_ops display7_fb_refresh_ops = {
+    .set = display7_fb_refresh_set,
+    .get = param_get_uint,
+};
+
+module_param_cb(fb_refresh_ms, &display7_fb_refresh_ops, &fb_refresh_ms, 0644);
+MODULE_PARM_DESC(fb_refresh_ms, "Shared framebuffer refresh tick in ms (0 = doorbell only)");
+
+// The refresh tick only runs, and the panel stays resumed, while at
+// least one mapping is alive. Every mapping holds a panel reference: it
+// can outlive both its file and the binding, the page itself staying
+// mapped until then.
+static void display7_vm_open(struct vm_area_struct *vma)
+{
+    struct display7_panel_st *panel = vma->vm_private_data;
+    unsigned long flags;
+
+    kref_get(&panel->kref);
+    if (atomic_inc_return(&panel->fb_users) == 1)
+    {
+        // Queued under the lock, so unbind cancels it
+        spin_lock_irqsave(&panel->lock, flags);
+        if (!panel->dead)
+        {
+            display7_pm_update(panel);
+            schedule_delayed_work(&panel->fb_work, 0);
+        }
+        spin_unlock_irqrestore(&panel->lock, flags);
+    }
+}
+
+static void display7_vm_close(struct vm_area_struct *vma)
+{
+    struct display7_panel_st *panel = vma->vm_private_data;
+    unsigned long flags;
+
+    if (atomic_dec_and_test(&panel->fb_users))
+    {
+        spin_lock_irqsave(&panel->lock, flags);
+        if (!panel->dead)
+        {
+            display7_pm_update(panel);
+        }
+        spin_unlock_irqrestore(&panel->lock, flags);
+    }
+    display7_panel_put(panel);
+}
+
+static const struct vm_operations_struct display7_vm_ops = {
+    .open = display7_vm_open,
+    .close = display7_vm_close,
+};
+
+static int display7_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct display7_panel_st *panel = display7_file_disp(file)->panel;
+    int result;
+
+    // A private mapping would copy the page on the first store, leaving
+    // the driver with the original
+    if (vma->vm_pgoff != DISPLAY7_FB_OFFSET ||
+        vma->vm_end - vma->vm_start != PAGE_SIZE ||
+        !(vma->vm_flags & VM_SHARED))
+    {
+        return -EINVAL;
+    }
+
+    result = display7_op_begin(panel);
+    if (result)
+    {
+        return result;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+#else
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+#endif
+    result = vm_insert_page(vma, vma->vm_start, virt_to_page(panel->fb));
+
+    // Resumed here since the mapping then holds the panel from atomic context
+    if (!result)
+    {
+        result = display7_pm_get(panel);
+    }
+    if (!result)
+    {
+        vma->vm_private_data = panel;
+        vma->vm_ops = &display7_vm_ops;
+        display7_vm_open(vma);
+        display7_pm_put(panel);
+    }
+    display7_op_end(panel);
+    return result;
+}
+
+// Applies a DISPLAY7_IOC_TXN: every entry is checked before any display
+// changes, then all of them go out in a single commit. Displays outside
+// the transaction are left alone, deferred masks included.
+static int display7_txn(struct display7_panel_st *panel, const struct display7_txn __user *utxn)
+{
+    struct display7_txn_entry entries[MAX_DISPLAYS];
+    DECLARE_BITMAP(seen, MAX_DISPLAYS);
+    struct display7_txn txn;
+    unsigned long flags;
+    unsigned int i;
+
+    if (copy_from_user(&txn, utxn, sizeof(txn)))
+    {
+        return -EFAULT;
+    }
+    if (txn.flags || !txn.count || txn.count > panel->ndisplays)
+    {
+        return -EINVAL;
+    }
+    if (copy_from_user(entries, u64_to_user_ptr(txn.entries), txn.count * sizeof(entries[0])))
+    {
+        return -EFAULT;
+    }
+
+    bitmap_zero(seen, MAX_DISPLAYS);
+    for (i = 0; i < txn.count; i++)
+    {
+        if (entries[i].index >= panel->ndisplays || entries[i].reserved[0] ||
+            entries[i].reserved[1] || __test_and_set_bit(entries[i].index, seen))
+        {
+            return -EINVAL;
+        }
+    }
+
+    spin_lock_irqsave(&panel->lock, flags);
+    for (i = 0; i < txn.count; i++)
+    {
+        struct display7_data_st *disp = &panel->displays[entries[i].index];
+
+        display7_scroll_stop(panel, disp->index);
+        display7_account_request(disp, 1);
+        disp->pending = entries[i].segments;
+        disp->digit = 0;
+        disp->requested = ktime_get();
+    }
+    display7_commit_displays(panel, seen);
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    return 0;
+}
+
+// Waits for the refresh timer to start a new scan cycle, which shows
+// every commit made before the call. Static panels show commits as they
+// happen, so there is nothing to wait for.
+static int display7_wait_vsync(struct display7_panel_st *panel)
+{
+    unsigned int cycle = READ_ONCE(panel->scan_cycles);
+    long result;
+
+    if (panel->scan_mode != SCAN_MULTIPLEXED)
+    {
+        return 0;
+    }
+
+    // Unbind stops the timer and wakes the waiters
+    result = wait_event_interruptible_timeout(panel->scan_wait,
+                                              READ_ONCE(panel->scan_cycles) != cycle ||
+                                              READ_ONCE(panel->dead),
+                                              msecs_to_jiffies(VSYNC_TIMEOUT_MS));
+    if (result < 0)
+    {
+        return result;
+    }
+    if (READ_ONCE(panel->dead))
+    {
+        return -ENODEV;
+    }
+    return result ? 0 : -ETIMEDOUT;
+}
+
+static long display7_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct display7_data_st *disp = display7_file_disp(file);
+    struct display7_panel_st *panel = disp->panel;
+    unsigned long flags;
+    u8 segments;
+    long result;
+
+    if (_IOC_TYPE(cmd) != DISPLAY7_IOC_MAGIC)
+    {
+        return -ENOTTY;
+    }
+
+    result = display7_op_begin(panel);
+    if (result)
+    {
+        return result;
+    }
+    result = display7_pm_get(panel);
+    if (result)
+    {
+        display7_op_end(panel);
+        return result;
+    }
+
+    switch (cmd)
+    {
+        case DISPLAY7_IOC_SET_SEGMENTS:
+            result = get_user(segments, (u8 __user *) arg);
+            if (!result)
+            {
+                display7_account_request(disp, 1);
+                WRITE_ONCE(disp->requested, ktime_get());
+                display7_show_segments(disp, segments);
+            }
+            break;
+        case DISPLAY7_IOC_DOORBELL:
+            display7_fb_sync(panel);
+            break;
+        case DISPLAY7_IOC_COMMIT:
+            spin_lock_irqsave(&panel->lock, flags);
+            display7_commit_held(panel);
+            spin_unlock_irqrestore(&panel->lock, flags);
+            break;
+        case DISPLAY7_IOC_FIFO_PUSH:
+            result = display7_fifo_push(disp, (struct display7_fifo_push __user *) arg);
+            break;
+        case DISPLAY7_IOC_FIFO_FLUSH:
+            display7_fifo_flush(disp);
+            break;
+        case DISPLAY7_IOC_TXN:
+            result = display7_txn(panel, (struct display7_txn __user *) arg);
+            break;
+        case DISPLAY7_IOC_WAIT_VSYNC:
+            result = display7_wait_vsync(panel);
+            break;
+        default:
+            result = -ENOTTY;
+            break;
+    }
+
+    display7_pm_put(panel);
+    display7_op_end(panel);
+    return result;
+}
+// ----------------------------------------------
+
+static const struct file_operations display7_fops = {
+    .owner = THIS_MODULE,
+    .open = display7_open,
+    .release = display7_release,
+    .read = display7_read,
+    .write = display7_write,
+    .poll = display7_poll,
+    .mmap = display7_mmap,
+    .unlocked_ioctl = display7_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = no_llseek,
+};
+
+// debugfs: /sys/kernel/debug/display7/<panel-device>/latency
+// ----------------------------------------------
+// Store-to-GPIO latency histogram of the commits that reached the lines
+// (set by the refresh timer on multiplexed panels and during BAM, so not
+// counted there), the failed GPIO writes of all displays, and how often and how
+// slowly the panel woke up from runtime suspend
+static int display7_latency_show(struct seq_file *m, void *v)
+{
+    struct display7_panel_st *panel = m->private;
+    u64 hist[LATENCY_BUCKETS];
+    u64 counters[NR_STATS];
+    u64 failures = 0, resumes, resume_max_ns;
+    unsigned long flags;
+    unsigned int b, i;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        display7_stats_sum(&panel->displays[i], counters);
+        failures += counters[STAT_GPIO_ERRORS];
+    }
+
+    spin_lock_irqsave(&panel->lock, flags);
+    memcpy(hist, panel->latency_hist, sizeof(hist));
+    resumes = panel->pm_resumes;
+    resume_max_ns = panel->pm_resume_max_ns;
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    seq_printf(m, "gpio_failures %llu\n", failures);
+    seq_printf(m, "pm_resumes %llu\n", resumes);
+    seq_printf(m, "pm_resume_max_ns %llu\n", resume_max_ns);
+    seq_puts(m, "# latency_ns count\n");
+    for (b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        if (hist[b])
+        {
+            seq_printf(m, "%llu-%llu %llu\n", 1ULL << b, (2ULL << b) - 1, hist[b]);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(display7_latency);
+
+// debugfs: /sys/kernel/debug/display7/<panel-device>/bench
+// ----------------------------------------------
+// Writing "<count> [<display>]" runs 'count' commits back to back on a
+// display (0 by default) of a static panel: alternating masks (uncached,
+// every line written) and a repeated one (cached, caught by the latched
+// mask), through gpiolib and, when the display has one, the fast path.
+// The display is left as it was, but its readers see every commit.
+// Reading shows the last results.
+
+// Times one commit of 'segments', up to the lines, deferred panels
+// included
+static u64 display7_bench_op(struct display7_data_st *disp, u8 segments)
+{
+    struct display7_panel_st *panel = disp->panel;
+    unsigned long flags;
+    u64 start;
+
+    spin_lock_irqsave(&panel->lock, flags);
+    start = ktime_get_ns();
+    disp->pending = segments;
+    disp->digit = 0;
+    display7_commit(disp);
+    if (!panel->deferred)
+    {
+        start = ktime_get_ns() - start;
+        spin_unlock_irqrestore(&panel->lock, flags);
+        return start;
+    }
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    flush_work(&panel->commit_work);
+    return ktime_get_ns() - start;
+}
+
+static void display7_bench_run(struct display7_data_st *disp, const char *path,
+        bool cached, unsigned int count, struct display7_bench_st *run)
+{
+    unsigned int i;
+
+    run->path = path;
+    run->cached = cached;
+    run->ops = count;
+    run->total_ns = 0;
+    run->min_ns = U64_MAX;
+    run->max_ns = 0;
+
+    // Known starting point: the first timed commit changes every line,
+    // or none
+    display7_bench_op(disp, cached ? 0xff : 0x00);
+
+    for (i = 0; i < count; i++)
+    {
+        u64 ns = display7_bench_op(disp, (cached || !(i & 1)) ? 0xff : 0x00);
+
+        run->total_ns += ns;
+        run->min_ns = min(run->min_ns, ns);
+        run->max_ns = max(run->max_ns, ns);
+        cond_resched();
+    }
+}
+
+// Runs every benchmark of a display. Called with the config lock held,
+// so BAM cannot start meanwhile.
+static int display7_bench(struct display7_data_st *disp, unsigned int count)
+{
+    struct display7_panel_st *panel = disp->panel;
+    struct gpio_chip *fast_chip;
+    unsigned long flags;
+    unsigned long pending;
+    char digit;
+
+    spin_lock_irqsave(&panel->lock, flags);
+    if (panel->scan_mode == SCAN_MULTIPLEXED || panel->bam)
+    {
+        // Commits only reach the lines through the refresh timer
+        spin_unlock_irqrestore(&panel->lock, flags);
+        return -EOPNOTSUPP;
+    }
+    if (disp->fifo_running)
+    {
+        spin_unlock_irqrestore(&panel->lock, flags);
+        return -EBUSY;
+    }
+    display7_scroll_stop(panel, disp->index);
+    pending = disp->pending;
+    digit = disp->digit;
+    fast_chip = disp->fast_chip;
+    disp->fast_chip = NULL;
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    panel->nbench = 0;
+    panel->bench_index = disp->index;
+    display7_bench_run(disp, panel->backend->name, false, count, &panel->bench[panel->nbench++]);
+    display7_bench_run(disp, panel->backend->name, true, count, &panel->bench[panel->nbench++]);
+
+    if (fast_chip)
+    {
+        spin_lock_irqsave(&panel->lock, flags);
+        disp->fast_chip = fast_chip;
+        disp->latched_valid = false;
+        spin_unlock_irqrestore(&panel->lock, flags);
+
+        display7_bench_run(disp, "fast", false, count, &panel->bench[panel->nbench++]);
+        display7_bench_run(disp, "fast", true, count, &panel->bench[panel->nbench++]);
+    }
+
+    spin_lock_irqsave(&panel->lock, flags);
+    disp->pending = pending;
+    disp->digit = digit;
+    display7_commit(disp);
+    spin_unlock_irqrestore(&panel->lock, flags);
+    return 0;
+}
+
+static int display7_bench_show(struct seq_file *m, void *v)
+{
+    struct display7_panel_st *panel = m->private;
+    struct display7_data_st *disp;
+    struct gpio_chip *chip;
+    unsigned int i;
+
+    mutex_lock(&panel->config_lock);
+    if (!panel->nbench)
+    {
+        mutex_unlock(&panel->config_lock);
+        seq_puts(m, "# write '<count> [<display>]' to run\n");
+        return 0;
+    }
+
+    disp = &panel->displays[panel->bench_index];
+    seq_printf(m, "display %s\n", disp->name);
+    if (disp->segments[0])
+    {
+        chip = gpiod_to_chip(disp->segments[0]);
+        seq_printf(m, "chip %s %s%s\n", chip->label,
+                   gpiod_cansleep(disp->segments[0]) ? "sleeping" : "non-sleeping",
+                   panel->deferred ? " deferred" : "");
+    }
+    else
+    {
+        seq_printf(m, "backend %s%s\n", panel->backend->name,
+                   panel->deferred ? " deferred" : "");
+    }
+    seq_puts(m, "# path cache ops ns/op min_ns max_ns\n");
+    for (i = 0; i < panel->nbench; i++)
+    {
+        struct display7_bench_st *run = &panel->bench[i];
+
+        seq_printf(m, "%s %s %llu %llu %llu %llu\n", run->path,
+                   run->cached ? "cached" : "uncached", run->ops,
+                   div64_u64(run->total_ns, run->ops), run->min_ns, run->max_ns);
+    }
+    mutex_unlock(&panel->config_lock);
+    return 0;
+}
+
+static int display7_bench_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, display7_bench_show, inode->i_private);
+}
+
+static ssize_t display7_bench_write(struct file *file, const char __user *ubuf,
+        size_t size, loff_t *ppos)
+{
+    struct display7_panel_st *panel = ((struct seq_file *) file->private_data)->private;
+    unsigned int count, index = 0;
+    char buf[32];
+    int result;
+
+    if (size >= sizeof(buf))
+    {
+        return -EINVAL;
+    }
+    if (copy_from_user(buf, ubuf, size))
+    {
+        return -EFAULT;
+    }
+    buf[size] = '\0';
+
+    if (sscanf(buf, "%u %u", &count, &index) < 1 ||
+        !count || count > MAX_BENCH_OPS || index >= panel->ndisplays)
+    {
+        return -EINVAL;
+    }
+
+    result = display7_pm_get(panel);
+    if (result)
+    {
+        return result;
+    }
+    mutex_lock(&panel->config_lock);
+    result = display7_bench(&panel->displays[index], count);
+    mutex_unlock(&panel->config_lock);
+    display7_pm_put(panel);
+
+    return result ? result : size;
+}
+
+static const struct file_operations display7_bench_fops = {
+    .owner = THIS_MODULE,
+    .open = display7_bench_open,
+    .read = seq_read,
+    .write = display7_bench_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+// ----------------------------------------------
+
+// Names the node /dev/display7-<N> instead of after the sysfs device
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+static char *display7_devnode(const struct device *dev, umode_t *mode)
+#else
+static char *display7_devnode(struct device *dev, umode_t *mode)
+#endif
+{
+    return kasprintf(GFP_KERNEL, CHRDEV_NAME_FMT, MINOR(dev->devt));
+}
+// ----------------------------------------------
+
+// Optional staggered commits of a static display: 'commit-groups' lists
+// segment masks (bit 0 = a ... 7 = dp) switched one after the other,
+// 'commit-group-delay-ns' apart, both its own. Lines in no group switch
+// with the first.
+static int display7_parse_groups(struct display7_panel_st *panel, struct device_node *np,
+        struct display7_data_st *disp)
+{
+    u32 groups[MAX_COMMIT_GROUPS];
+    u32 delay_ns = DEFAULT_GROUP_DELAY_NS;
+    unsigned long lines;
+    unsigned int l;
+    int count, g;
+
+    count = of_property_count_u32_elems(np, "commit-groups");
+    if (count == -EINVAL)
+    {
+        return 0;
+    }
+    if (count <= 0 || count > MAX_COMMIT_GROUPS ||
+        of_property_read_u32_array(np, "commit-groups", groups, count))
+    {
+        dev_err(panel->dev, "%s: expected 1 to %d entries in commit-groups",
+                disp->name, MAX_COMMIT_GROUPS);
+        return -EINVAL;
+    }
+
+    of_property_read_u32(np, "commit-group-delay-ns", &delay_ns);
+    if (delay_ns > MAX_GROUP_DELAY_NS)
+    {
+        dev_err(panel->dev, "%s: commit-group-delay-ns above %d",
+                disp->name, MAX_GROUP_DELAY_NS);
+        return -EINVAL;
+    }
+
+    for (g = 0; g < count; g++)
+    {
+        if (groups[g] > 0xFF)
+        {
+            dev_err(panel->dev, "%s: invalid commit-groups mask 0x%x", disp->name, groups[g]);
+            return -EINVAL;
+        }
+        lines = display7_wire(disp, groups[g]) & disp->line_mask;
+        for_each_set_bit(l, &lines, disp->nsegments)
+        {
+            disp->line_group[l] = g;
+        }
+    }
+
+    // A single group switches everything at once anyway
+    disp->ngroups = count;
+    disp->group_delay_ns = delay_ns;
+    disp->staggered = count > 1;
+    panel->staggered |= disp->staggered;
+    return 0;
+}
+
+// Reads the name, the dimming and the outputs of a display from its
+// device tree node
+static int display7_parse_display(struct device_node *child, struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    const char *label = NULL;
+    int result;
+
+    if (!of_property_read_string(child, "label", &label))
+    {
+        if (!strncmp(label, LABEL_PREFIX, strlen(LABEL_PREFIX)))
+        {
+            label += strlen(LABEL_PREFIX);
+        }
+        disp->name = label;
+    }
+    else
+    {
+        disp->name = devm_kasprintf(panel->dev, GFP_KERNEL,
+                                    DISPLAY_DEVICE_NAME_FMT, MINOR(disp->devnum) + 1);
+        if (!disp->name)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    // Full brightness: no BAM until told otherwise
+    disp->brightness = MAX_BRIGHTNESS;
+    memset(disp->segment_brightness, MAX_BRIGHTNESS, sizeof(disp->segment_brightness));
+    display7_compute_planes(MAX_BRIGHTNESS, disp->segment_brightness, disp->plane_mask);
+
+    // Optional hardware PWM dimming the whole display (e.g. on its common line)
+    if (of_find_property(child, "pwms", NULL))
+    {
+        disp->pwm = devm_fwnode_pwm_get(panel->dev, of_fwnode_handle(child), NULL);
+        if (IS_ERR(disp->pwm))
+        {
+            dev_err(panel->dev, "Error getting PWM of %s: %ld",
+                    disp->name, PTR_ERR(disp->pwm));
+            return PTR_ERR(disp->pwm);
+        }
+        result = display7_apply_pwm(disp);
+        if (result)
+        {
+            dev_err(panel->dev, "Error enabling PWM of %s: %d", disp->name, result);
+            return result;
+        }
+    }
+
+    return panel->backend->parse_display(child, disp);
+}
+
+// GPIO backend: the segment lines of a static display, or the select line
+// of a multiplexed one
+static int display7_gpio_parse_display(struct device_node *child, struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    const char *con_id = "segment";
+    char legacy_con_id[16];
+    unsigned int i;
+    int result;
+
+    // Multiplexed displays only own their digit-select line
+    if (panel->scan_mode == SCAN_MULTIPLEXED)
+    {
+        disp->select = devm_fwnode_gpiod_get(panel->dev, of_fwnode_handle(child),
+                                             "select", GPIOD_OUT_LOW, disp->name);
+        if (IS_ERR(disp->select))
+        {
+            dev_err(panel->dev, "Error getting select GPIO of %s: %ld",
+                    disp->name, PTR_ERR(disp->select));
+            return PTR_ERR(disp->select);
+        }
+        if (gpiod_cansleep(disp->select))
+        {
+            dev_err(panel->dev, "Multiplexed scanning needs non-sleeping GPIOS");
+            return -EINVAL;
+        }
+        disp->remap = panel->scan_remap;
+        return 0;
+    }
+
+    // Get from device tree the gpios named "segment-gpios" (or "disp<N>-gpios").
+    // The descriptors are set to Output and level to Low (0)
+    for (i = 0; i < MAX_SEGMENTS; i++)
+    {
+        struct gpio_desc *desc;
+
+        desc = devm_fwnode_gpiod_get_index(panel->dev, of_fwnode_handle(child),
+                                           con_id, i, GPIOD_OUT_LOW, disp->name);
+        if (IS_ERR(desc) && PTR_ERR(desc) == -ENOENT && i == 0 && con_id != legacy_con_id)
+        {
+            snprintf(legacy_con_id, sizeof(legacy_con_id), "disp%u", disp->index + 1);
+            con_id = legacy_con_id;
+            desc = devm_fwnode_gpiod_get_index(panel->dev, of_fwnode_handle(child),
+                                               con_id, i, GPIOD_OUT_LOW, disp->name);
+        }
+
+        if (IS_ERR(desc))
+        {
+            if (PTR_ERR(desc) == -ENOENT && i > 0)
+            {
+                break;
+            }
+            dev_err(panel->dev, "Error getting GPIOS of %s: %ld", disp->name, PTR_ERR(desc));
+            return PTR_ERR(desc);
+        }
+
+        disp->segments[i] = desc;
+        if (gpiod_cansleep(desc))
+        {
+            panel->deferred = true;
+        }
+    }
+    disp->nsegments = i;
+    disp->line_mask = GENMASK(disp->nsegments - 1, 0);
+
+    result = display7_parse_order(panel, child, disp->nsegments, &disp->remap);
+    if (result)
+    {
+        return result;
+    }
+
+    result = display7_parse_groups(panel, child, disp);
+    if (result)
+    {
+        return result;
+    }
+
+    // gpiod_get() drove every line low
+    disp->latched = 0;
+    disp->latched_valid = true;
+
+    return 0;
+}
+
+// Sets up the fast path of a display on a static, non-deferred panel.
+// Only taken when all its lines sit on one chip that can't sleep, has
+// set_multiple() and keeps them within a long, so a commit is a single
+// call into the GPIO driver with a mask from the precomputed table.
+// gpiolib is bypassed: the lines must be plain push-pull outputs, and the
+// GPIO controller must stay bound while the panel is.
+static void display7_setup_fast(struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    struct gpio_chip *chip = gpiod_to_chip(disp->segments[0]);
+    unsigned int offset[MAX_SEGMENTS];
+    unsigned int m, s;
+
+    // A single set_multiple() cannot stagger the lines
+    if (!chip || !chip->set_multiple || chip->can_sleep || disp->staggered)
+    {
+        return;
+    }
+    for (s = 0; s < disp->nsegments; s++)
+    {
+        if (gpiod_to_chip(disp->segments[s]) != chip)
+        {
+            return;
+        }
+        offset[s] = desc_to_gpio(disp->segments[s]) - chip->base;
+        if (offset[s] >= BITS_PER_LONG)
+        {
+            return;
+        }
+    }
+
+    disp->fast_bits = devm_kcalloc(panel->dev, BIT(MAX_SEGMENTS),
+                                   sizeof(*disp->fast_bits), GFP_KERNEL);
+    if (!disp->fast_bits)
+    {
+        return;
+    }
+
+    disp->fast_mask = 0;
+    for (s = 0; s < disp->nsegments; s++)
+    {
+        disp->fast_mask |= BIT(offset[s]);
+    }
+    for (m = 0; m < BIT(MAX_SEGMENTS); m++)
+    {
+        for (s = 0; s < disp->nsegments; s++)
+        {
+            if (!!(m & BIT(s)) != !!gpiod_is_active_low(disp->segments[s]))
+            {
+                disp->fast_bits[m] |= BIT(offset[s]);
+            }
+        }
+    }
+
+    disp->fast_chip = chip;
+    dev_info(panel->dev, "%s: direct writes to %s", disp->name, chip->label);
+}
+
+// GPIO backend: sizes the commit arrays for every segment line, sets up
+// the fast path and lists the lines BAM drives
+static int display7_gpio_init(struct display7_panel_st *panel)
+{
+    unsigned int i;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        panel->ndescs += panel->displays[i].nsegments;
+    }
+
+    // Room for every segment line in one commit (none on multiplexed panels)
+    panel->descs = devm_kcalloc(panel->dev, max(panel->ndescs, 1U),
+                                sizeof(*panel->descs), GFP_KERNEL);
+    panel->values = devm_kcalloc(panel->dev, max(BITS_TO_LONGS(panel->ndescs), 1UL),
+                                 sizeof(*panel->values), GFP_KERNEL);
+    panel->desc_disp = devm_kcalloc(panel->dev, max(panel->ndescs, 1U),
+                                    sizeof(*panel->desc_disp), GFP_KERNEL);
+    panel->desc_group = devm_kcalloc(panel->dev, max(panel->ndescs, 1U),
+                                     sizeof(*panel->desc_group), GFP_KERNEL);
+    if (!panel->descs || !panel->values || !panel->desc_disp || !panel->desc_group)
+    {
+        return -ENOMEM;
+    }
+    if (panel->staggered)
+    {
+        panel->group_descs = devm_kcalloc(panel->dev, panel->ndescs,
+                                          sizeof(*panel->group_descs), GFP_KERNEL);
+        panel->group_values = devm_kcalloc(panel->dev, BITS_TO_LONGS(panel->ndescs),
+                                           sizeof(*panel->group_values), GFP_KERNEL);
+        if (!panel->group_descs || !panel->group_values)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    // Opt-in direct chip writes (see display7_setup_fast())
+    if (of_property_read_bool(panel->dev->of_node, "direct-gpio") &&
+        panel->scan_mode == SCAN_STATIC && !panel->deferred)
+    {
+        for (i = 0; i < panel->ndisplays; i++)
+        {
+            display7_setup_fast(&panel->displays[i]);
+        }
+        panel->fast_writes = devm_kcalloc(panel->dev, panel->ndisplays,
+                                          sizeof(*panel->fast_writes), GFP_KERNEL);
+        if (!panel->fast_writes)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    // Lines of the displays without fast path in display order, for BAM
+    // on static panels
+    panel->lines = devm_kcalloc(panel->dev, max(panel->ndescs, 1U),
+                                sizeof(*panel->lines), GFP_KERNEL);
+    panel->line_values = devm_kcalloc(panel->dev, max(BITS_TO_LONGS(panel->ndescs), 1UL),
+                                      sizeof(*panel->line_values), GFP_KERNEL);
+    if (!panel->lines || !panel->line_values)
+    {
+        return -ENOMEM;
+    }
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        struct display7_data_st *disp = &panel->displays[i];
+
+        if (disp->fast_chip)
+        {
+            continue;
+        }
+        memcpy(&panel->lines[panel->nlines], disp->segments,
+               disp->nsegments * sizeof(*panel->lines));
+        panel->nlines += disp->nsegments;
+    }
+
+    // Multiplexed panels are driven from the scan timer, never deferred
+    if (panel->scan_mode == SCAN_MULTIPLEXED)
+    {
+        panel->deferred = false;
+    }
+    return 0;
+}
+
+static const struct display7_backend_ops display7_gpio_backend = {
+    .name = "gpiolib",
+    .multiplexed = true,
+    .parse_display = display7_gpio_parse_display,
+    .init = display7_gpio_init,
+    .prepare = display7_gpio_prepare,
+    .write = display7_gpio_write,
+};
+// ----------------------------------------------
+
+#if IS_ENABLED(CONFIG_SPI_MASTER)
+// SPI backends
+// ----------------------------------------------
+// A display is one 8-bit register of the chain (74HC595) or one digit of
+// a chip (MAX7219), in device tree order from the controller on. Its
+// outputs are taken in the order a..g, dp unless 'segment-order' says
+// otherwise.
+static int display7_spi_parse_display(struct device_node *np, struct display7_data_st *disp)
+{
+    disp->nsegments = MAX_SEGMENTS;
+    disp->line_mask = GENMASK(MAX_SEGMENTS - 1, 0);
+    return display7_parse_order(disp->panel, np, MAX_SEGMENTS, &disp->remap);
+}
+
+// Latches the pending mask of a display for the next transfer.
+// Returns false when the outputs already show it.
+static bool display7_spi_latch(struct display7_data_st *disp)
+{
+    if (disp->latched_valid && disp->latched == disp->pending)
+    {
+        display7_stat_inc(disp, STAT_CACHE_HITS);
+        return false;
+    }
+    display7_stat_inc(disp, STAT_CACHE_MISSES);
+    disp->latched = disp->pending;
+    disp->latched_valid = true;
+    return true;
+}
+
+// Common setup: the bus sleeps, so every commit is deferred
+static void display7_spi_setup(struct display7_panel_st *panel)
+{
+    panel->spi = to_spi_device(panel->dev);
+    panel->deferred = true;
+}
+
+// 74HC595 chains: the whole chain is shifted on every commit, so one
+// transfer of one byte per display, the farthest register first. CS
+// drives the storage register clock (RCLK), latching every output at once.
+static void display7_hc595_fill(struct display7_panel_st *panel)
+{
+    unsigned int i;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        u8 levels = display7_wire(&panel->displays[i], panel->displays[i].latched);
+
+        panel->spi_tx[panel->ndisplays - 1 - i] = panel->spi_active_low ? ~levels : levels;
+    }
+}
+
+static int display7_hc595_init(struct display7_panel_st *panel)
+{
+    unsigned int i;
+    int result;
+
+    display7_spi_setup(panel);
+    panel->spi_active_low = of_property_read_bool(panel->dev->of_node, "output-active-low");
+    panel->spi_len = panel->ndisplays;
+    panel->spi_tx = devm_kzalloc(panel->dev, panel->spi_len, GFP_KERNEL);
+    if (!panel->spi_tx)
+    {
+        return -ENOMEM;
+    }
+
+    // Shift registers power up with random outputs
+    display7_hc595_fill(panel);
+    result = spi_write(panel->spi, panel->spi_tx, panel->spi_len);
+    if (result)
+    {
+        dev_err(panel->dev, "Error blanking the shift registers: %d", result);
+        return result;
+    }
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        panel->displays[i].latched_valid = true;
+    }
+    return 0;
+}
+
+static unsigned int display7_hc595_prepare(struct display7_panel_st *panel, unsigned long *dirty)
+{
+    bool changed = false;
+    unsigned int i;
+
+    for_each_set_bit(i, dirty, panel->ndisplays)
+    {
+        if (display7_spi_latch(&panel->displays[i]))
+        {
+            changed = true;
+            continue;
+        }
+        __clear_bit(i, dirty);
+        panel->displays[i].requested = 0;
+    }
+    if (!changed)
+    {
+        return 0;
+    }
+
+    display7_hc595_fill(panel);
+    return panel->spi_len;
+}
+
+static int display7_hc595_write(struct display7_panel_st *panel, unsigned int n)
+{
+    return spi_write(panel->spi, panel->spi_tx, n);
+}
+
+static const struct display7_backend_ops display7_hc595_backend = {
+    .name = "74hc595",
+    .parse_display = display7_spi_parse_display,
+    .init = display7_hc595_init,
+    .prepare = display7_hc595_prepare,
+    .write = display7_hc595_write,
+};
+
+// MAX7219 chains: each chip scans up to 8 digits by itself and latches a
+// 16-bit (register, value) word on the rising edge of CS (LOAD). A
+// daisy chain takes one word per chip per CS cycle, the farthest chip's
+// first, so a commit is one spi_sync() of one transfer per changed digit
+// row, CS toggling in between.
+
+// Segments of a display in the no-decode order of the chip: dp, a ... g
+// from D7 down to D0
+static u8 display7_max7219_segments(struct display7_data_st *disp)
+{
+    u8 lines = display7_wire(disp, disp->latched);
+
+    return (lines & BIT(7)) | bitrev8((lines & 0x7F) << 1);
+}
+
+// Sets register 'reg' of every chip, chip 'c' to 'values[c]'
+static int display7_max7219_cmd(struct display7_panel_st *panel, u8 reg, const u8 *values)
+{
+    unsigned int c, nchips = panel->max7219_chips;
+    u8 *buf;
+    int result;
+
+    // spi_write() may DMA from it
+    buf = kmalloc(2 * nchips, GFP_KERNEL);
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+    for (c = 0; c < nchips; c++)
+    {
+        buf[2 * (nchips - 1 - c)] = reg;
+        buf[2 * (nchips - 1 - c) + 1] = values[c];
+    }
+    result = spi_write(panel->spi, buf, 2 * nchips);
+    kfree(buf);
+    return result;
+}
+
+static int display7_max7219_set(struct display7_panel_st *panel, u8 reg, u8 value)
+{
+    u8 values[MAX7219_CHIPS];
+
+    memset(values, value, sizeof(values));
+    return display7_max7219_cmd(panel, reg, values);
+}
+
+// A chip runs at the highest level of its digits. Level 0 is its dimmest
+// setting, not off.
+static int display7_max7219_set_brightness(struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    u8 values[MAX7219_CHIPS] = { 0 };
+    unsigned int i;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        u8 *value = &values[i / MAX7219_DIGITS];
+
+        *value = max(*value, READ_ONCE(panel->displays[i].brightness));
+    }
+    return display7_max7219_cmd(panel, MAX7219_REG_INTENSITY, values);
+}
+
+static int display7_max7219_power(struct display7_panel_st *panel, bool on)
+{
+    return display7_max7219_set(panel, MAX7219_REG_SHUTDOWN, on);
+}
+
+static int display7_max7219_init(struct display7_panel_st *panel)
+{
+    u8 values[MAX7219_CHIPS];
+    unsigned int c, d, i;
+    int result;
+
+    display7_spi_setup(panel);
+    panel->max7219_chips = DIV_ROUND_UP(panel->ndisplays, MAX7219_DIGITS);
+    panel->spi_len = 2 * panel->max7219_chips;
+    panel->spi_tx = devm_kcalloc(panel->dev, MAX7219_DIGITS, panel->spi_len, GFP_KERNEL);
+    panel->spi_xfers = devm_kcalloc(panel->dev, MAX7219_DIGITS, sizeof(*panel->spi_xfers),
+                                    GFP_KERNEL);
+    if (!panel->spi_tx || !panel->spi_xfers)
+    {
+        return -ENOMEM;
+    }
+
+    // Raw segments, no display test, each chip scanning only the digits
+    // it has, all blank
+    result = display7_max7219_set(panel, MAX7219_REG_TEST, 0);
+    if (!result)
+    {
+        result = display7_max7219_set(panel, MAX7219_REG_DECODE, 0);
+    }
+    for (c = 0; c < panel->max7219_chips; c++)
+    {
+        values[c] = min_t(unsigned int, panel->ndisplays - c * MAX7219_DIGITS,
+                          MAX7219_DIGITS) - 1;
+    }
+    if (!result)
+    {
+        result = display7_max7219_cmd(panel, MAX7219_REG_SCAN_LIMIT, values);
+    }
+    for (d = 0; d < MAX7219_DIGITS && !result; d++)
+    {
+        result = display7_max7219_set(panel, MAX7219_REG_DIGIT0 + d, 0);
+    }
+    if (!result)
+    {
+        result = display7_max7219_set_brightness(&panel->displays[0]);
+    }
+    if (!result)
+    {
+        result = display7_max7219_power(panel, true);
+    }
+    if (result)
+    {
+        dev_err(panel->dev, "Error setting up the MAX7219 chips: %d", result);
+        return result;
+    }
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        panel->displays[i].latched_valid = true;
+    }
+    return 0;
+}
+
+// Lays out the digit rows holding a change, one after the other
+static unsigned int display7_max7219_prepare(struct display7_panel_st *panel, unsigned long *dirty)
+{
+    unsigned int nchips = panel->max7219_chips;
+    unsigned long rows = 0;
+    unsigned int c, d, i, n = 0;
+
+    for_each_set_bit(i, dirty, panel->ndisplays)
+    {
+        if (display7_spi_latch(&panel->displays[i]))
+        {
+            rows |= BIT(i % MAX7219_DIGITS);
+            continue;
+        }
+        __clear_bit(i, dirty);
+        panel->displays[i].requested = 0;
+    }
+
+    for_each_set_bit(d, &rows, MAX7219_DIGITS)
+    {
+        u8 *row = panel->spi_tx + n * panel->spi_len;
+
+        for (c = 0; c < nchips; c++)
+        {
+            u8 *word = row + 2 * (nchips - 1 - c);
+
+            i = c * MAX7219_DIGITS + d;
+            if (i < panel->ndisplays)
+            {
+                word[0] = MAX7219_REG_DIGIT0 + d;
+                word[1] = display7_max7219_segments(&panel->displays[i]);
+            }
+            else
+            {
+                word[0] = MAX7219_REG_NOOP;
+                word[1] = 0;
+            }
+        }
+        n++;
+    }
+    return n;
+}
+
+static int display7_max7219_write(struct display7_panel_st *panel, unsigned int n)
+{
+    struct spi_message message;
+    unsigned int k;
+
+    spi_message_init(&message);
+    for (k = 0; k < n; k++)
+    {
+        struct spi_transfer *xfer = &panel->spi_xfers[k];
+
+        memset(xfer, 0, sizeof(*xfer));
+        xfer->tx_buf = panel->spi_tx + k * panel->spi_len;
+        xfer->len = panel->spi_len;
+        // LOAD latches each row
+        xfer->cs_change = k + 1 < n;
+        spi_message_add_tail(xfer, &message);
+    }
+    return spi_sync(panel->spi, &message);
+}
+
+static const struct display7_backend_ops display7_max7219_backend = {
+    .name = "max7219",
+    .parse_display = display7_spi_parse_display,
+    .init = display7_max7219_init,
+    .prepare = display7_max7219_prepare,
+    .write = display7_max7219_write,
+    .set_brightness = display7_max7219_set_brightness,
+    .power = display7_max7219_power,
+};
+// ----------------------------------------------
+#endif  // CONFIG_SPI_MASTER
+
+// Unregisters a display (devm action of display7_add_display())
+static void display7_del_display(void *data)
+{
+    struct display7_data_st *disp = data;
+    struct display7_panel_st *panel = disp->panel;
+    struct kernfs_node *kn = disp->digit_kn;
+    unsigned long flags;
+
+    spin_lock_irqsave(&panel->lock, flags);
+    disp->digit_kn = NULL;
+    spin_unlock_irqrestore(&panel->lock, flags);
+    sysfs_put(kn);
+
+    cdev_device_del(&disp->cdev, &disp->dev);
+    put_device(&disp->dev);
+}
+
+// The open files hold the character device, which holds the device
+static void display7_device_release(struct device *dev)
+{
+    struct display7_data_st *disp = container_of(dev, struct display7_data_st, dev);
+
+    display7_panel_put(disp->panel);
+}
+
+// Registers the character device and the sysfs device of a display
+static int display7_add_display(struct display7_data_st *disp)
+{
+    struct display7_panel_st *panel = disp->panel;
+    int result;
+
+    // A device inside /sys/class/display7/, along with its subfiles:
+    // echo'ing and cat'ting 'digit' will call *_store() and *_show()
+    // functions respectively. No parent device.
+    device_initialize(&disp->dev);
+    disp->dev.class = display7_class;
+    disp->dev.devt = disp->devnum;
+    disp->dev.groups = display7_groups;
+    disp->dev.release = display7_device_release;
+    dev_set_drvdata(&disp->dev, disp);
+    kref_get(&panel->kref);
+
+    result = dev_set_name(&disp->dev, "%s", disp->name);
+    if (result)
+    {
+        goto ret_err_device;
+    }
+
+    // The character device behind the allocated number, living as long
+    // as the device
+    cdev_init(&disp->cdev, &display7_fops);
+    disp->cdev.owner = THIS_MODULE;
+    result = cdev_device_add(&disp->cdev, &disp->dev);
+    if (result)
+    {
+        dev_err(panel->dev, "Failed to create a device file!");
+        goto ret_err_device;
+    }
+
+    // Looked up once: commits notify it from atomic context
+    disp->digit_kn = sysfs_get_dirent(disp->dev.kobj.sd, "digit");
+    if (!disp->digit_kn)
+    {
+        result = -ENOENT;
+        dev_err(panel->dev, "Failed to look up the digit sub-file!");
+        goto ret_err_get_dirent;
+    }
+
+    // Torn down on unbind, before the panel state it uses
+    return devm_add_action_or_reset(panel->dev, display7_del_display, disp);
+
+ret_err_get_dirent:
+    cdev_device_del(&disp->cdev, &disp->dev);
+ret_err_device:
+    put_device(&disp->dev);
+    return result;
+}
+
+// Device-managed teardown of the panel, run on unbind (or a failed
+// probe) in reverse order of probe
+// ----------------------------------------------
+// Drops the reference of the binding
+static void display7_put_panel(void *data)
+{
+    display7_panel_put(data);
+}
+
+// Gives back the minors of a panel's displays
+static void display7_free_minors(void *data)
+{
+    struct display7_panel_st *panel = data;
+    unsigned int i;
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        if (panel->displays[i].devnum)
+        {
+            ida_free(&display7_minors, MINOR(panel->displays[i].devnum));
+        }
+    }
+}
+
+// Live mappings keep their own reference to the page
+static void display7_free_fb(void *data)
+{
+    struct display7_panel_st *panel = data;
+
+    free_page((unsigned long) panel->fb);
+}
+
+// Lets the last queued commit reach the display
+static void display7_destroy_commit_wq(void *data)
+{
+    struct display7_panel_st *panel = data;
+
+    destroy_workqueue(panel->commit_wq);
+}
+
+// Cuts the open files and mappings off the panel once no new ones can
+// be opened. They keep their panel reference, but from then on every
+// file operation fails with -ENODEV and nothing they do reaches the
+// lines, timers or works.
+static void display7_disconnect(void *data)
+{
+    struct display7_panel_st *panel = data;
+    unsigned long flags;
+    unsigned int i;
+
+    spin_lock_irqsave(&panel->lock, flags);
+    panel->dead = true;
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    // Blocked readers, dwells and vsync waits give up
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        wake_up_interruptible_all(&panel->displays[i].wait);
+    }
+    wake_up_all(&panel->scan_wait);
+
+    // Then the operations already past the check finish
+    down_write(&panel->ops_lock);
+    up_write(&panel->ops_lock);
+}
+
+// Stops everything that updates the displays on its own
+static void display7_stop(void *data)
+{
+    struct display7_panel_st *panel = data;
+    unsigned long flags;
+    unsigned int i;
+
+    spin_lock_irqsave(&panel->lock, flags);
+    panel->scroll_len = 0;
+    spin_unlock_irqrestore(&panel->lock, flags);
+    cancel_delayed_work_sync(&panel->scroll_work);
+    cancel_delayed_work_sync(&panel->fb_work);
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        hrtimer_cancel(&panel->displays[i].fifo_timer);
+    }
+    hrtimer_cancel(&panel->scan_timer);
+
+    // The usage count outlives the binding
+    spin_lock_irqsave(&panel->lock, flags);
+    if (panel->pm_held)
+    {
+        panel->pm_held = false;
+        pm_runtime_put_noidle(panel->dev);
+    }
+    spin_unlock_irqrestore(&panel->lock, flags);
+}
+
+static void display7_remove_debugfs(void *data)
+{
+    struct display7_panel_st *panel = data;
+
+    debugfs_remove_recursive(panel->debugfs);
+}
+// ----------------------------------------------
+
+// Runtime PM callbacks
+// ----------------------------------------------
+// Only reached once the panel is blank and idle (see display7_pm_update()),
+// so the static segment lines already sit at their inactive level. Stops
+// the refresh timer, deselects the multiplexed display that was lit and
+// turns the PWMs and the backend off.
+static int __maybe_unused display7_runtime_suspend(struct device *dev)
+{
+    struct display7_panel_st *panel = dev_get_drvdata(dev);
+    unsigned long flags;
+    unsigned int i;
+
+    // Let a deferred blank commit reach the lines first
+    if (panel->commit_wq)
+    {
+        flush_workqueue(panel->commit_wq);
+    }
+    hrtimer_cancel(&panel->scan_timer);
+
+    spin_lock_irqsave(&panel->lock, flags);
+    if (panel->scan_mode == SCAN_MULTIPLEXED)
+    {
+        gpiod_set_value(panel->displays[panel->scan_pos].select, 0);
+    }
+    else if (panel->bam)
+    {
+        display7_scan_static_restore(panel);
+    }
+    spin_unlock_irqrestore(&panel->lock, flags);
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        if (panel->displays[i].pwm)
+        {
+            pwm_disable(panel->displays[i].pwm);
+        }
+    }
+
+    if (panel->backend->power)
+    {
+        return panel->backend->power(panel, false);
+    }
+    return 0;
+}
+
+// Runs synchronously in the first write after suspend, so its cost (PWM
+// setup and a timer start) bounds the wake latency, which is recorded
+static int __maybe_unused display7_runtime_resume(struct device *dev)
+{
+    struct display7_panel_st *panel = dev_get_drvdata(dev);
+    ktime_t start = ktime_get();
+    unsigned long flags;
+    unsigned int i;
+    u64 elapsed;
+    int result;
+
+    if (panel->backend->power)
+    {
+        result = panel->backend->power(panel, true);
+        if (result)
+        {
+            dev_err(dev, "Failed to power %s up: %d", panel->backend->name, result);
+            return result;
+        }
+    }
+
+    for (i = 0; i < panel->ndisplays; i++)
+    {
+        if (panel->displays[i].pwm)
+        {
+            result = display7_apply_pwm(&panel->displays[i]);
+            if (result)
+            {
+                dev_err(dev, "Failed to resume the PWM of %s", panel->displays[i].name);
+                return result;
+            }
+        }
+    }
+
+    if (panel->scan_mode == SCAN_MULTIPLEXED || READ_ONCE(panel->bam))
+    {
+        display7_scan_start(panel);
+    }
+
+    elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+    spin_lock_irqsave(&panel->lock, flags);
+    panel->pm_resumes++;
+    panel->pm_resume_max_ns = max(panel->pm_resume_max_ns, elapsed);
+    spin_unlock_irqrestore(&panel->lock, flags);
+    return 0;
+}
+
+static const struct dev_pm_ops display7_pm_ops = {
+    SET_RUNTIME_PM_OPS(display7_runtime_suspend, display7_runtime_resume, NULL)
+};
+// ----------------------------------------------
+
+// Counters and commit history of a display, freed along with the panel
+static int display7_alloc_display(struct display7_data_st *disp)
+{
+    int cpu;
+
+    disp->history = kcalloc(HISTORY_LEN, sizeof(*disp->history), GFP_KERNEL);
+    if (!disp->history)
+    {
+        return -ENOMEM;
+    }
+
+    disp->stats = alloc_percpu(struct display7_pcpu_stats_st);
+    if (!disp->stats)
+    {
+        return -ENOMEM;
+    }
+    for_each_possible_cpu(cpu)
+    {
+        u64_stats_init(&per_cpu_ptr(disp->stats, cpu)->syncp);
+    }
+    return 0;
+}
+
+// Sets up a panel on any bus, 'backend' driving its outputs
+static int display7_panel_probe(struct device *dev, const struct display7_backend_ops *backend)
+{
+    struct device_node *np = dev->of_node;      // Parent
+    struct device_node *child = NULL;           // Child device-tree node
+    struct display7_panel_st *panel;
+    u32 autosuspend_ms = DEFAULT_AUTOSUSPEND_MS;
+    unsigned int i, ndisplays;
+    int result;
+
+    ndisplays = of_get_available_child_count(np);
+    if (!ndisplays || ndisplays > MAX_DISPLAYS)
+    {
+        dev_err(dev, "Expected 1 to %d display nodes, found %u",
+                MAX_DISPLAYS, ndisplays);
+        return -EINVAL;
+    }
+
+    // Reference counted, see display7_panel_release()
+    panel = kzalloc(sizeof(*panel), GFP_KERNEL);
+    if (!panel)
+    {
+        return -ENOMEM;
+    }
+    kref_init(&panel->kref);
+    result = devm_add_action_or_reset(dev, display7_put_panel, panel);
+    if (result)
+    {
+        return result;
+    }
+    panel->displays = kcalloc(ndisplays, sizeof(*panel->displays), GFP_KERNEL);
+    if (!panel->displays)
+    {
+        return -ENOMEM;
+    }
+    panel->dev = dev;
+    panel->ndisplays = ndisplays;
+    panel->backend = backend;
+    dev_set_drvdata(dev, panel);
+    spin_lock_init(&panel->lock);
+    init_rwsem(&panel->ops_lock);
+    mutex_init(&panel->config_lock);
+    seqcount_spinlock_init(&panel->scan_seq, &panel->lock);
+    seqcount_init(&panel->scan_stats_seq);
+    init_waitqueue_head(&panel->scan_wait);
+    panel->scan_frame = panel->scan_frames[0];
+    panel->scan_back = 0;
+    atomic_set(&panel->scan_ready, 1);
+    panel->scan_front = 2;
+    atomic_set(&panel->fb_users, 0);
+    INIT_DELAYED_WORK(&panel->fb_work, display7_fb_work);
+    INIT_WORK(&panel->commit_work, display7_commit_work);
+    display7_glyphs_init(panel->glyphs);
+    INIT_DELAYED_WORK(&panel->scroll_work, display7_scroll_work);
+    panel->scroll_ms = DEFAULT_SCROLL_MS;
+    panel->deferred = of_property_read_bool(np, "deferred-commit");
+
+    // One minor per display, unique across panels (/dev/display7-<minor>)
+    result = devm_add_action_or_reset(dev, display7_free_minors, panel);
+    if (result)
+    {
+        return result;
+    }
+    for (i = 0; i < ndisplays; i++)
+    {
+        result = ida_alloc_max(&display7_minors, DISPLAY7_MINORS - 1, GFP_KERNEL);
+        if (result < 0)
+        {
+            dev_err(dev, "Out of device numbers");
+            return result;
+        }
+        panel->displays[i].devnum = MKDEV(MAJOR(display7_devbase), result);
+    }
+
+    result = display7_parse_scan(np, panel);
+    if (result)
+    {
+        return result;
+    }
+
+    // Parse every child display node.
+    // The GPIO descriptors are device-managed and released on unbind.
+    i = 0;
+    for_each_available_child_of_node(np, child)
+    {
+        panel->displays[i].panel = panel;
+        panel->displays[i].index = i;
+        seqcount_spinlock_init(&panel->displays[i].state_seq, &panel->lock);
+        init_waitqueue_head(&panel->displays[i].wait);
+        INIT_KFIFO(panel->displays[i].fifo);
+        mutex_init(&panel->displays[i].fifo_lock);
+        hrtimer_init(&panel->displays[i].fifo_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        panel->displays[i].fifo_timer.function = display7_fifo_tick;
+        result = display7_alloc_display(&panel->displays[i]);
+        if (!result)
+        {
+            result = display7_parse_display(child, &panel->displays[i]);
+        }
+        if (result)
+        {
+            of_node_put(child);
+            return result;
+        }
+        i++;
+    }
+
+    result = backend->init(panel);
+    if (result)
+    {
+        return result;
+    }
+
+    // One page of raw segment masks, mmap()able from the character devices
+    panel->fb = (u8 *) get_zeroed_page(GFP_KERNEL);
+    if (!panel->fb)
+    {
+        return -ENOMEM;
+    }
+    result = devm_add_action_or_reset(dev, display7_free_fb, panel);
+    if (result)
+    {
+        return result;
+    }
+
+    if (panel->deferred)
+    {
+        panel->commit_wq = alloc_ordered_workqueue("%s-commit", WQ_HIGHPRI,
+                                                   dev_name(panel->dev));
+        if (!panel->commit_wq)
+        {
+            return -ENOMEM;
+        }
+        result = devm_add_action_or_reset(dev, display7_destroy_commit_wq, panel);
+        if (result)
+        {
+            return result;
+        }
+    }
+
+    // Runtime PM, starting active (and blank). The delay can be changed
+    // later through power/autosuspend_delay_ms of the panel device.
+    of_property_read_u32(np, "autosuspend-delay-ms", &autosuspend_ms);
+    pm_runtime_set_autosuspend_delay(dev, autosuspend_ms);
+    pm_runtime_use_autosuspend(dev);
+    pm_runtime_set_active(dev);
+    result = devm_pm_runtime_enable(dev);
+    if (result)
+    {
+        return result;
+    }
+
+    result = devm_add_action_or_reset(dev, display7_stop, panel);
+    if (result)
+    {
+        return result;
+    }
+
+    // Past this point the character devices can be opened
+    result = devm_add_action_or_reset(dev, display7_disconnect, panel);
+    if (result)
+    {
+        return result;
+    }
+
+    // Define a custom user-space interface 
+    // -----------------------------------------------------------------
+    for (i = 0; i < ndisplays; i++)
+    {
+        result = display7_add_display(&panel->displays[i]);
+        if (result)
+        {
+            return result;
+        }
+    }
+    // ------------------------------------------------------------------
+
+    if (panel->scan_mode == SCAN_MULTIPLEXED)
+    {
+        display7_scan_start(panel);
+    }
+
+    // Instrumentation only, so failures are not fatal
+    panel->debugfs = debugfs_create_dir(dev_name(dev), display7_debugfs);
+    debugfs_create_file("latency", 0444, panel->debugfs, panel, &display7_latency_fops);
+    debugfs_create_file("bench", 0600, panel->debugfs, panel, &display7_bench_fops);
+    result = devm_add_action_or_reset(dev, display7_remove_debugfs, panel);
+    if (result)
+    {
+        return result;
+    }
+
+    // The driver core idles the panel after probe, from then on it
+    // suspends 'autosuspend_ms' after its last use
+    pm_runtime_mark_last_busy(dev);
+
+    dev_info(panel->dev, "Driver initialized with %u displays (%s).", ndisplays, backend->name);
+    return 0;
+}
+
+static int display7_probe(struct platform_device *pdev)
+{
+    return display7_panel_probe(&pdev->dev, device_get_match_data(&pdev->dev));
+}
+
+static const struct of_device_id of_display7_match[] = {
+    {.compatible = "filhodamain,display7", .data = &display7_gpio_backend},
+    {},
+};
+
+static struct platform_driver display7_driver = {
+    .driver = {
+        .name = DRIVER_NAME,
+        .owner = THIS_MODULE,
+        .of_match_table = of_display7_match,
+        .pm = &display7_pm_ops,
+        // Probing may block on slow GPIO expanders
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+    },
+    .probe = display7_probe,
+};
+
+#if IS_ENABLED(CONFIG_SPI_MASTER)
+static int display7_spi_probe(struct spi_device *spi)
+{
+    const struct display7_backend_ops *backend = device_get_match_data(&spi->dev);
+
+    if (!backend)
+    {
+        backend = (const struct display7_backend_ops *) spi_get_device_id(spi)->driver_data;
+    }
+    return display7_panel_probe(&spi->dev, backend);
+}
+
+static const struct of_device_id of_display7_spi_match[] = {
+    {.compatible = "filhodamain,display7-74hc595", .data = &display7_hc595_backend},
+    {.compatible = "filhodamain,display7-max7219", .data = &display7_max7219_backend},
+    {},
+};
+
+static const struct spi_device_id display7_spi_ids[] = {
+    {"display7-74hc595", (kernel_ulong_t) &display7_hc595_backend},
+    {"display7-max7219", (kernel_ulong_t) &display7_max7219_backend},
+    {},
+};
+
+static struct spi_driver display7_spi_driver = {
+    .driver = {
+        .name = DRIVER_NAME "-spi",
+        .owner = THIS_MODULE,
+        .of_match_table = of_display7_spi_match,
+        .pm = &display7_pm_ops,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+    },
+    .id_table = display7_spi_ids,
+    .probe = display7_spi_probe,
+};
+#endif
+
+// The class and the device numbers are shared by every panel
+static int __init display7_init(void)
+{
+    int result;
+
+    // Allocate a Major Number
+    // After success call, display7_devbase represents a unique
+    // MAJOR | MINOR number, minors handed out to displays as they probe
+    result = alloc_chrdev_region(&display7_devbase, 0, DISPLAY7_MINORS, DRIVER_NAME);
+    if (result)
+    {
+        pr_err(DRIVER_NAME ": Failed to allocate device numbers\n");
+        goto ret_err_alloc_chrdev_region;
+    }
+
+    // Create a class of devices to appear in /sys/class/
+    display7_class = class_create(THIS_MODULE, SYSCLASS_NAME);
+    if (IS_ERR(display7_class))
+    {
+        result = PTR_ERR(display7_class);
+        goto ret_err_class_create;
+    }
+    display7_class->devnode = display7_devnode;
+
+    display7_debugfs = debugfs_create_dir(DRIVER_NAME, NULL);
+
+    result = platform_driver_register(&display7_driver);
+    if (result)
+    {
+        goto ret_err_driver_register;
+    }
+#if IS_ENABLED(CONFIG_SPI_MASTER)
+    result = spi_register_driver(&display7_spi_driver);
+    if (result)
+    {
+        goto ret_err_spi_register;
+    }
+#endif
+    return 0;
+
+#if IS_ENABLED(CONFIG_SPI_MASTER)
+ret_err_spi_register:
+    platform_driver_unregister(&display7_driver);
+#endif
+ret_err_driver_register:
+    debugfs_remove_recursive(display7_debugfs);
+    class_destroy(display7_class);
+ret_err_class_create:
+    unregister_chrdev_region(display7_devbase, DISPLAY7_MINORS);
+ret_err_alloc_chrdev_region:
+    return result;
+}
+
+static void __exit display7_exit(void)
+{
+#if IS_ENABLED(CONFIG_SPI_MASTER)
+    spi_unregister_driver(&display7_spi_driver);
+#endif
+    platform_driver_unregister(&display7_driver);
+    debugfs_remove_recursive(display7_debugfs);
+    class_destroy(display7_class);
+    unregister_chrdev_region(display7_devbase, DISPLAY7_MINORS);
+    ida_destroy(&display7_minors);
+}
 
-module_platform_driver(display7_driver);
+module_init(display7_init);
+module_exit(display7_exit);
 
 MODULE_LICENSE("GPL v2");
 MODULE_AUTHOR("Andre Temprilho (filhoDaMain)");
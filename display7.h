@@ -0,0 +1,140 @@
+//
+// display7.h
+//
+// User-space interface of the display7 driver.
+// Shared between the kernel module and user-space programs driving
+// /dev/display7-<N>.
+//
+
+#ifndef DISPLAY7_H
+#define DISPLAY7_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// A frame as written to /dev/display7-<N>.
+//
+// write() takes any number of frames back to back (the size must be a
+// multiple of sizeof(struct display7_frame)) and applies them in order.
+// A frame stays on the display for 'dwell_us' microseconds before the
+// next one is applied. The last frame's dwell is also honoured, so
+// consecutive write() calls keep their pacing.
+//
+// A frame flagged DISPLAY7_FRAME_DEFER only updates the pending segment
+// mask of its display. The deferred masks of every display are then
+// output together by DISPLAY7_IOC_COMMIT, unless a later write to the
+// same display outputs its own first.
+struct display7_frame {
+    __u8  digit;            // Character to show (same as sysfs 'digit')
+    __u8  flags;            // DISPLAY7_FRAME_*
+    __u8  reserved[2];      // Must be zero
+    __u32 dwell_us;         // Hold time in microseconds (0 = none)
+};
+
+#define DISPLAY7_FRAME_DEFER    (1 << 0)
+#define DISPLAY7_FRAME_FLAGS    (DISPLAY7_FRAME_DEFER)
+
+// Shared segment framebuffer.
+//
+// mmap() of /dev/display7-<N> at offset 0 (MAP_SHARED only) maps one
+// page shared by all displays. Byte <i> holds the raw segment mask of display <i>, in the
+// same bit order as the driver's segment table:
+//   [dp] [g] [f] [e] [d] [c] [b] [a]
+// The driver picks up changed bytes on its refresh tick (module parameter
+// 'fb_refresh_ms') or right away on DISPLAY7_IOC_DOORBELL.
+#define DISPLAY7_FB_OFFSET      0
+
+// A change event as read from /dev/display7-<N>.
+//
+// The driver keeps one event per commit of the display in a fixed-size
+// history ring (timestamps from CLOCK_MONOTONIC). Every open file streams
+// it from the first commit after open(): read() blocks until there is a
+// new event (unless O_NONBLOCK) and returns as many whole events as fit;
+// poll() reports POLLIN while events are left to read. A reader falling
+// too far behind loses the oldest events, 'seq' shows the gap.
+struct display7_event {
+    __u64 timestamp_ns;     // Time of the commit
+    __u32 seq;              // Commit sequence number of the display
+    __u8  digit;            // Character shown (0 for raw segment masks)
+    __u8  segments;         // Segment mask committed ([dp] [g] ... [a])
+    __u8  reserved[2];
+    __s32 pid;              // Process that requested the frame (thread group
+                            // id), 0 for the driver's own (framebuffer tick)
+    __u32 reserved2;
+};
+
+// Playback FIFO.
+//
+// DISPLAY7_IOC_FIFO_PUSH appends 'count' entries to the FIFO of the
+// display and starts playing them if it was idle. Each entry's mask stays
+// on for 'duration_us' (at least 50) microseconds, timed by an hrtimer.
+// The ioctl returns how many entries were queued, fewer than 'count' once
+// the FIFO is full; 'fifo_depth' in sysfs shows the fill level and size.
+//
+// With DISPLAY7_FIFO_LOOP played entries go back to the tail, so the
+// queue repeats until DISPLAY7_IOC_FIFO_FLUSH. Without it the FIFO running
+// dry counts as an underrun ('fifo_underruns' in sysfs 'stats'), unless
+// the last push was flagged DISPLAY7_FIFO_END.
+struct display7_fifo_entry {
+    __u8  segments;         // Raw segment mask ([dp] [g] ... [a])
+    __u8  reserved[3];      // Must be zero
+    __u32 duration_us;
+};
+
+struct display7_fifo_push {
+    __u64 entries;          // User pointer to struct display7_fifo_entry[]
+    __u32 count;
+    __u32 flags;            // DISPLAY7_FIFO_*
+};
+
+#define DISPLAY7_FIFO_LOOP      (1 << 0)
+#define DISPLAY7_FIFO_END       (1 << 1)
+#define DISPLAY7_FIFO_FLAGS     (DISPLAY7_FIFO_LOOP | DISPLAY7_FIFO_END)
+
+// Atomic panel update.
+//
+// DISPLAY7_IOC_TXN sets the raw segment masks of several displays of the
+// panel and outputs them together: one GPIO commit on static panels, one
+// scan frame update on multiplexed ones, so no intermediate state is ever
+// shown. 'index' is the position of the display in the panel (device tree
+// order, as in the framebuffer page); each one at most once per call.
+// The other displays are left alone: their deferred masks
+// (DISPLAY7_FRAME_DEFER) wait for DISPLAY7_IOC_COMMIT. Nothing is applied
+// if an entry is invalid.
+struct display7_txn_entry {
+    __u8  index;            // Display of the panel
+    __u8  segments;         // Raw segment mask ([dp] [g] ... [a])
+    __u8  reserved[2];      // Must be zero
+};
+
+struct display7_txn {
+    __u64 entries;          // User pointer to struct display7_txn_entry[]
+    __u32 count;            // 1 up to the number of displays of the panel
+    __u32 flags;            // Must be zero
+};
+
+#define DISPLAY7_IOC_MAGIC      0xD7
+
+// Applies pending framebuffer changes now
+#define DISPLAY7_IOC_DOORBELL   _IO(DISPLAY7_IOC_MAGIC, 0x00)
+
+// Outputs the deferred segment masks of all displays in one commit
+#define DISPLAY7_IOC_COMMIT     _IO(DISPLAY7_IOC_MAGIC, 0x01)
+
+// Shows a raw segment mask ([dp] [g] ... [a]) on the display of the node
+#define DISPLAY7_IOC_SET_SEGMENTS   _IOW(DISPLAY7_IOC_MAGIC, 0x02, __u8)
+
+// Queues playback FIFO entries (see struct display7_fifo_push)
+#define DISPLAY7_IOC_FIFO_PUSH  _IOW(DISPLAY7_IOC_MAGIC, 0x03, struct display7_fifo_push)
+
+// Stops playback and empties the FIFO
+#define DISPLAY7_IOC_FIFO_FLUSH _IO(DISPLAY7_IOC_MAGIC, 0x04)
+
+// Updates several displays as one (see struct display7_txn)
+#define DISPLAY7_IOC_TXN        _IOW(DISPLAY7_IOC_MAGIC, 0x05, struct display7_txn)
+
+// Waits until the next scan cycle of a multiplexed panel starts, showing
+// everything committed before the call (returns at once on static panels)
+#define DISPLAY7_IOC_WAIT_VSYNC _IO(DISPLAY7_IOC_MAGIC, 0x06)
+
+#endif  // DISPLAY7_H
@@ -0,0 +1,107 @@
+//
+// display7_trace.h
+//
+// Tracepoints of the display7 driver (trace system "display7").
+// Included once from display7.c with CREATE_TRACE_POINTS defined.
+//
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM display7
+
+#if !defined(DISPLAY7_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define DISPLAY7_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Entry of a write to the 'digit' sysfs file
+TRACE_EVENT(display7_store,
+
+    TP_PROTO(unsigned int index, const char *buf, size_t size),
+
+    TP_ARGS(index, buf, size),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, index)
+        __field(char, first)
+        __field(size_t, size)
+    ),
+
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->first = size ? buf[0] : 0;
+        __entry->size = size;
+    ),
+
+    TP_printk("display=%u first=0x%02x size=%zu",
+              __entry->index, (unsigned char) __entry->first, __entry->size)
+);
+
+// A character turned into a segment mask ('shown' differs from 'c' when
+// the character has no glyph)
+TRACE_EVENT(display7_decode,
+
+    TP_PROTO(unsigned char c, char shown, u8 segments),
+
+    TP_ARGS(c, shown, segments),
+
+    TP_STRUCT__entry(
+        __field(unsigned char, c)
+        __field(char, shown)
+        __field(u8, segments)
+    ),
+
+    TP_fast_assign(
+        __entry->c = c;
+        __entry->shown = shown;
+        __entry->segments = segments;
+    ),
+
+    TP_printk("c=0x%02x shown=0x%02x segments=0x%02x",
+              __entry->c, (unsigned char) __entry->shown, __entry->segments)
+);
+
+// Around the gpiolib call of a commit, 'nlines' lines changing level
+TRACE_EVENT(display7_gpio_set_start,
+
+    TP_PROTO(unsigned int nlines),
+
+    TP_ARGS(nlines),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, nlines)
+    ),
+
+    TP_fast_assign(
+        __entry->nlines = nlines;
+    ),
+
+    TP_printk("nlines=%u", __entry->nlines)
+);
+
+TRACE_EVENT(display7_gpio_set_end,
+
+    TP_PROTO(unsigned int nlines, int result),
+
+    TP_ARGS(nlines, result),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, nlines)
+        __field(int, result)
+    ),
+
+    TP_fast_assign(
+        __entry->nlines = nlines;
+        __entry->result = result;
+    ),
+
+    TP_printk("nlines=%u result=%d", __entry->nlines, __entry->result)
+);
+
+#endif  // DISPLAY7_TRACE_H
+
+// The header sits next to display7.c, out of include/trace/events/
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE display7_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,417 @@
+//
+// display7-load.c
+//
+// Load generator for the display7 driver.
+// Hammers one display through one of its interfaces from any number of
+// writer threads, optionally rate limited, and reports throughput and
+// the latency percentiles of each operation.
+//
+// Modes:
+//  sysfs    open, write "<c>\n" to .../digit and close, like 'echo'
+//  sysfs-k  write "<c>\n" to .../digit, kept open
+//  chardev  write() of one struct display7_frame per syscall
+//  batch    write() of '-b' frames per syscall
+//  mmap     store of one byte into the shared framebuffer page, plus
+//           DISPLAY7_IOC_DOORBELL with '-D'
+//
+// Example:
+//  display7-load -m batch -b 16 -t 2 -r 1000 -d 10 -c /dev/display7-0
+//
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "display7.h"
+
+
+#define SYSFS_FMT           "/sys/class/display7/%s/digit"
+#define DEFAULT_NAME        "user:1"
+#define DEFAULT_CHRDEV      "/dev/display7-0"
+#define DEFAULT_SECONDS     5
+#define MAX_THREADS         64
+#define MAX_BATCH           1024
+
+// Latency samples kept per thread, later ones are counted but not stored
+#define MAX_SAMPLES         (1 << 18)
+
+enum load_mode {
+    MODE_SYSFS,
+    MODE_SYSFS_KEEP,
+    MODE_CHARDEV,
+    MODE_BATCH,
+    MODE_MMAP,
+};
+
+static const char *mode_names[] = {
+    [MODE_SYSFS] = "sysfs",
+    [MODE_SYSFS_KEEP] = "sysfs-k",
+    [MODE_CHARDEV] = "chardev",
+    [MODE_BATCH] = "batch",
+    [MODE_MMAP] = "mmap",
+};
+
+struct load_config {
+    enum load_mode mode;
+    unsigned int threads;
+    unsigned int rate;          // Operations per second and thread, 0 = flat out
+    unsigned int seconds;
+    unsigned int batch;         // Frames per write() in batch mode
+    unsigned int fb_index;      // Display byte in the framebuffer page
+    int doorbell;
+    char sysfs_path[256];
+    const char *chrdev;
+};
+
+struct load_thread {
+    const struct load_config *config;
+    pthread_t thread;
+    unsigned int id;
+
+    // Results
+    uint64_t ops;
+    uint64_t frames;
+    uint64_t errors;
+    uint64_t *samples;          // Latency of each operation, ns
+    size_t nsamples;
+};
+
+static volatile int load_running = 1;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Sleeps until the absolute CLOCK_MONOTONIC time 'deadline' (ns)
+static void sleep_until(uint64_t deadline)
+{
+    struct timespec ts = {
+        .tv_sec = deadline / 1000000000ULL,
+        .tv_nsec = deadline % 1000000000ULL,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Characters cycled through so every commit changes the lines
+static char load_digit(uint64_t n)
+{
+    return '0' + n % 10;
+}
+
+static void *load_worker(void *arg)
+{
+    struct load_thread *t = arg;
+    const struct load_config *config = t->config;
+    struct display7_frame frames[MAX_BATCH];
+    uint64_t period = config->rate ? 1000000000ULL / config->rate : 0;
+    uint64_t next = now_ns();
+    volatile uint8_t *fb = NULL;
+    int fd = -1;
+
+    if (config->mode == MODE_SYSFS_KEEP)
+    {
+        fd = open(config->sysfs_path, O_WRONLY);
+    }
+    else if (config->mode != MODE_SYSFS)
+    {
+        fd = open(config->chrdev, O_RDWR);
+    }
+    if (config->mode != MODE_SYSFS && fd < 0)
+    {
+        perror("open");
+        t->errors++;
+        return NULL;
+    }
+
+    if (config->mode == MODE_MMAP)
+    {
+        void *page = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd, DISPLAY7_FB_OFFSET);
+
+        if (page == MAP_FAILED)
+        {
+            perror("mmap");
+            t->errors++;
+            close(fd);
+            return NULL;
+        }
+        fb = page;
+    }
+
+    memset(frames, 0, sizeof(frames));
+
+    while (load_running)
+    {
+        uint64_t start, n = t->ops * config->threads + t->id;
+        unsigned int i, nframes = 1;
+        char text[2] = { load_digit(n), '\n' };
+        ssize_t result = 0;
+
+        if (period)
+        {
+            sleep_until(next);
+            next += period;
+        }
+
+        start = now_ns();
+        switch (config->mode)
+        {
+            case MODE_SYSFS:
+                fd = open(config->sysfs_path, O_WRONLY);
+                result = fd < 0 ? -1 : write(fd, text, sizeof(text));
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                break;
+            case MODE_SYSFS_KEEP:
+                result = write(fd, text, sizeof(text));
+                break;
+            case MODE_CHARDEV:
+                frames[0].digit = text[0];
+                result = write(fd, frames, sizeof(frames[0]));
+                break;
+            case MODE_BATCH:
+                nframes = config->batch;
+                for (i = 0; i < nframes; i++)
+                {
+                    frames[i].digit = load_digit(n + i);
+                }
+                result = write(fd, frames, nframes * sizeof(frames[0]));
+                break;
+            case MODE_MMAP:
+                fb[config->fb_index] = 1 << (n % 8);
+                if (config->doorbell)
+                {
+                    result = ioctl(fd, DISPLAY7_IOC_DOORBELL);
+                }
+                break;
+        }
+
+        if (result < 0)
+        {
+            t->errors++;
+        }
+        if (t->nsamples < MAX_SAMPLES)
+        {
+            t->samples[t->nsamples++] = now_ns() - start;
+        }
+        t->ops++;
+        t->frames += nframes;
+    }
+
+    if (fb)
+    {
+        munmap((void *) fb, getpagesize());
+    }
+    if (fd >= 0 && config->mode != MODE_SYSFS)
+    {
+        close(fd);
+    }
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -m <mode>     sysfs, sysfs-k, chardev, batch or mmap (default sysfs)\n"
+            "  -t <threads>  writer threads (default 1, max %d)\n"
+            "  -r <rate>     operations per second and thread (default 0, flat out)\n"
+            "  -d <seconds>  run time (default %d)\n"
+            "  -b <frames>   frames per write() in batch mode (default 16, max %d)\n"
+            "  -n <name>     display name in /sys/class/display7 (default %s)\n"
+            "  -c <path>     character device (default %s)\n"
+            "  -i <index>    display byte in the framebuffer page (default 0)\n"
+            "  -D            ring DISPLAY7_IOC_DOORBELL after every mmap store\n",
+            prog, MAX_THREADS, DEFAULT_SECONDS, MAX_BATCH, DEFAULT_NAME, DEFAULT_CHRDEV);
+}
+
+static int parse_mode(const char *name, enum load_mode *mode)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++)
+    {
+        if (!strcmp(name, mode_names[i]))
+        {
+            *mode = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    struct load_config config = {
+        .mode = MODE_SYSFS,
+        .threads = 1,
+        .seconds = DEFAULT_SECONDS,
+        .batch = 16,
+        .chrdev = DEFAULT_CHRDEV,
+    };
+    const char *name = DEFAULT_NAME;
+    struct load_thread *threads;
+    uint64_t ops = 0, frames = 0, errors = 0, start, elapsed;
+    uint64_t *samples;
+    size_t nsamples = 0;
+    unsigned int i;
+    double seconds;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:t:r:d:b:n:c:i:Dh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                if (parse_mode(optarg, &config.mode))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 't':
+                config.threads = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                config.rate = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                config.seconds = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                config.batch = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                name = optarg;
+                break;
+            case 'c':
+                config.chrdev = optarg;
+                break;
+            case 'i':
+                config.fb_index = strtoul(optarg, NULL, 0);
+                break;
+            case 'D':
+                config.doorbell = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return opt != 'h';
+        }
+    }
+
+    if (!config.threads || config.threads > MAX_THREADS || !config.seconds ||
+        !config.batch || config.batch > MAX_BATCH || config.fb_index >= (unsigned int) getpagesize())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    snprintf(config.sysfs_path, sizeof(config.sysfs_path), SYSFS_FMT, name);
+
+    threads = calloc(config.threads, sizeof(*threads));
+    if (!threads)
+    {
+        perror("calloc");
+        return 1;
+    }
+    for (i = 0; i < config.threads; i++)
+    {
+        threads[i].config = &config;
+        threads[i].id = i;
+        threads[i].samples = malloc(MAX_SAMPLES * sizeof(*threads[i].samples));
+        if (!threads[i].samples)
+        {
+            perror("malloc");
+            return 1;
+        }
+    }
+
+    start = now_ns();
+    for (i = 0; i < config.threads; i++)
+    {
+        if (pthread_create(&threads[i].thread, NULL, load_worker, &threads[i]))
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    sleep(config.seconds);
+    load_running = 0;
+    for (i = 0; i < config.threads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+    }
+    elapsed = now_ns() - start;
+
+    // Merge every thread's samples for the percentiles
+    for (i = 0; i < config.threads; i++)
+    {
+        ops += threads[i].ops;
+        frames += threads[i].frames;
+        errors += threads[i].errors;
+        nsamples += threads[i].nsamples;
+    }
+    samples = malloc((nsamples ? nsamples : 1) * sizeof(*samples));
+    if (!samples)
+    {
+        perror("malloc");
+        return 1;
+    }
+    nsamples = 0;
+    for (i = 0; i < config.threads; i++)
+    {
+        memcpy(samples + nsamples, threads[i].samples,
+               threads[i].nsamples * sizeof(*samples));
+        nsamples += threads[i].nsamples;
+        free(threads[i].samples);
+    }
+    qsort(samples, nsamples, sizeof(*samples), cmp_u64);
+
+    seconds = elapsed / 1e9;
+    printf("mode %s threads %u rate %u/s duration %.2f s\n",
+           mode_names[config.mode], config.threads, config.rate, seconds);
+    printf("ops %llu (%.0f/s) frames %llu (%.0f/s) errors %llu\n",
+           (unsigned long long) ops, ops / seconds,
+           (unsigned long long) frames, frames / seconds,
+           (unsigned long long) errors);
+    if (nsamples)
+    {
+        printf("latency_ns min %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+               (unsigned long long) samples[0],
+               (unsigned long long) samples[nsamples * 50 / 100],
+               (unsigned long long) samples[nsamples * 90 / 100],
+               (unsigned long long) samples[nsamples * 99 / 100],
+               (unsigned long long) samples[nsamples * 999 / 1000],
+               (unsigned long long) samples[nsamples - 1]);
+    }
+
+    free(samples);
+    free(threads);
+    return errors ? 2 : 0;
+}